@@ -26,8 +26,12 @@
 #include <sys/mman.h>
 #endif
 
+#include <time.h>
+#include <algorithm>
+
 #include "util/logger.h"
 #include "util/string.h"
+#include "util/thread.h"
 #include "binlog.h"
 
 bool TextConfigFile::read(const std::string &fname, std::vector<std::string> &values)
@@ -96,10 +100,242 @@ void BinlogFileList::saveToFile(BinlogFileList *index, const std::string &fname)
 
 
 
+BinlogIndex::BinlogIndex(void)
+{
+    clear();
+}
+
+BinlogIndex::~BinlogIndex(void)
+{
+}
+
+void BinlogIndex::clear(void)
+{
+    m_offsets.clear();
+    m_recordCount = 0;
+    m_size = sizeof(Binlog::Header);
+    m_lastSeq = 0;
+}
+
+void BinlogIndex::addRecord(long long offset, int size, long long seq)
+{
+    if (m_recordCount % Interval == 0) {
+        m_offsets.push_back(offset);
+    }
+    ++m_recordCount;
+    m_size = offset + size;
+    m_lastSeq = seq;
+}
+
+long long BinlogIndex::findRecord(int record, int* first) const
+{
+    int entry = (record < 0) ? 0 : record / Interval;
+    if (entry >= (int)m_offsets.size()) {
+        entry = (int)m_offsets.size() - 1;
+    }
+    if (entry < 0) {
+        *first = 0;
+        return sizeof(Binlog::Header);
+    }
+    *first = entry * Interval;
+    return m_offsets[entry];
+}
+
+long long BinlogIndex::findOffset(long long offset, int* first) const
+{
+    std::vector<long long>::const_iterator it =
+            std::upper_bound(m_offsets.begin(), m_offsets.end(), offset);
+    if (it == m_offsets.begin()) {
+        *first = 0;
+        return sizeof(Binlog::Header);
+    }
+    --it;
+    *first = (int)(it - m_offsets.begin()) * Interval;
+    return *it;
+}
+
+bool BinlogIndex::build(BinlogIndex* index, const std::string& binlogFile)
+{
+    index->clear();
+    return extend(index, binlogFile);
+}
+
+bool BinlogIndex::extend(BinlogIndex* index, const std::string& binlogFile)
+{
+#ifndef WIN32
+    int fd = ::open(binlogFile.c_str(), O_RDONLY);
+    if (fd < 0) {
+        Logger::log(Logger::Error, "BinlogIndex::extend: open(%s): %s", binlogFile.c_str(), strerror(errno));
+        return false;
+    }
+    struct stat sbuf;
+    if (::fstat(fd, &sbuf) != 0) {
+        ::close(fd);
+        return false;
+    }
+
+    const int chunkSize = 1024 * 1024;
+    std::vector<char> buff(chunkSize);
+    long long fileSize = sbuf.st_size;
+    long long offset = index->m_size;
+    while (offset + (long long)sizeof(Binlog::LogItem) <= fileSize) {
+        int len = (int)std::min<long long>(buff.size(), fileSize - offset);
+        int n = ::pread(fd, &buff[0], len, offset);
+        if (n < (int)sizeof(Binlog::LogItem)) {
+            break;
+        }
+        int used = 0;
+        bool broken = false;
+        while (used + (int)sizeof(Binlog::LogItem) <= n) {
+            Binlog::LogItem* item = (Binlog::LogItem*)(&buff[0] + used);
+            if (!item->hasValidHeader() || offset + used + item->item_size > fileSize) {
+                broken = true;
+                break;
+            }
+            if (used + item->item_size > n) {
+                break;
+            }
+            if (!item->isValid(n - used)) {
+                broken = true;
+                break;
+            }
+            index->addRecord(offset + used, item->item_size, item->seq);
+            used += item->item_size;
+        }
+        offset += used;
+        if (broken) {
+            break;
+        }
+        //A record larger than the buffer
+        if (used == 0) {
+            Binlog::LogItem* item = (Binlog::LogItem*)(&buff[0]);
+            buff.resize(item->item_size);
+        }
+    }
+    if (offset < fileSize) {
+        Logger::log(Logger::Warning, "BinlogIndex::extend: %s: %lld bytes of broken records at %lld",
+                    binlogFile.c_str(), fileSize - offset, offset);
+    }
+    ::close(fd);
+    return true;
+#else
+    (void)index;
+    (void)binlogFile;
+    return false;
+#endif
+}
+
+bool BinlogIndex::loadFromFile(BinlogIndex* index, const std::string& binlogFile)
+{
+    index->clear();
+#ifndef WIN32
+    struct stat sbuf;
+    if (::stat(binlogFile.c_str(), &sbuf) != 0) {
+        return false;
+    }
+
+    //A checkpoint of a growing binlog covers a prefix of the file
+    std::string indexFile = binlogFile + ".idx";
+    FILE* fp = fopen(indexFile.c_str(), "rb");
+    if (fp) {
+        FileHeader header;
+        bool ok = (fread(&header, sizeof(header), 1, fp) == 1 &&
+                   header.magic == (unsigned int)FileHeader::_magic &&
+                   header.interval == Interval &&
+                   header.size <= sbuf.st_size &&
+                   header.entryCount >= 0);
+        if (ok) {
+            index->m_offsets.resize(header.entryCount);
+            ok = (header.entryCount == 0 ||
+                  fread(&index->m_offsets[0], sizeof(long long), header.entryCount, fp) ==
+                  (size_t)header.entryCount);
+        }
+        fclose(fp);
+        if (ok) {
+            index->m_recordCount = header.recordCount;
+            index->m_size = header.size;
+            index->m_lastSeq = header.lastSeq;
+            if (header.size == sbuf.st_size) {
+                return true;
+            }
+        } else {
+            index->clear();
+        }
+    }
+
+    if (!extend(index, binlogFile)) {
+        return false;
+    }
+    //A binlog with a broken tail is not indexed to its end, validate it again next time
+    if (index->m_size == sbuf.st_size) {
+        saveToFile(index, binlogFile);
+    }
+    return true;
+#else
+    (void)binlogFile;
+    return false;
+#endif
+}
+
+bool BinlogIndex::saveToFile(const BinlogIndex* index, const std::string& binlogFile)
+{
+    char tmpFile[1024];
+    snprintf(tmpFile, sizeof(tmpFile), "%s.idx.%llu", binlogFile.c_str(), Thread::currentThreadId());
+    FILE* fp = fopen(tmpFile, "wb");
+    if (!fp) {
+        Logger::log(Logger::Error, "BinlogIndex::saveToFile: fopen(%s): %s", tmpFile, strerror(errno));
+        return false;
+    }
+
+    FileHeader header;
+    header.magic = FileHeader::_magic;
+    header.interval = Interval;
+    header.recordCount = index->m_recordCount;
+    header.entryCount = (int)index->m_offsets.size();
+    header.size = index->m_size;
+    header.lastSeq = index->m_lastSeq;
+    bool ok = (fwrite(&header, sizeof(header), 1, fp) == 1);
+    if (ok && header.entryCount > 0) {
+        ok = (fwrite(&index->m_offsets[0], sizeof(long long), header.entryCount, fp) ==
+              (size_t)header.entryCount);
+    }
+    if (fclose(fp) != 0) {
+        ok = false;
+    }
+    std::string indexFile = binlogFile + ".idx";
+    if (!ok || rename(tmpFile, indexFile.c_str()) != 0) {
+        remove(tmpFile);
+        return false;
+    }
+    return true;
+}
+
+
+
+bool Binlog::LogItem::hasValidHeader(void) const
+{
+    return item_size >= (int)sizeof(LogItem) &&
+            key_size >= 0 && value_size >= 0 &&
+            (long long)sizeof(LogItem) + key_size + value_size == item_size &&
+            (type == SET || type == DEL);
+}
+
+bool Binlog::LogItem::isValid(long long avail) const
+{
+    if (avail < (long long)sizeof(LogItem) || !hasValidHeader() || item_size > avail) {
+        return false;
+    }
+    return crc == checksum(payloadChecksum());
+}
+
+
+
 Binlog::Binlog(void)
 {
     m_fp = NULL;
     m_writtenSize = 0;
+    m_lastSeq = 0;
+    m_checkpointSize = 0;
 }
 
 Binlog::~Binlog(void)
@@ -131,6 +367,13 @@ bool Binlog::open(const std::string &fname)
 
     bool error = false;
     if (fileSize < sizeof(Header)) {
+#ifndef WIN32
+        //A torn header
+        if (fileSize > 0 && ftruncate(fileno(fp), 0) != 0) {
+            Logger::log(Logger::Error, "Binlog::open: ftruncate() failed: %s", strerror(errno));
+            error = true;
+        }
+#endif
         //Write header
         Header header;
         header.handshake = Header::_handshake;
@@ -143,7 +386,11 @@ bool Binlog::open(const std::string &fname)
         Header header;
         size_t readsize = fread(&header, sizeof(Header), 1, fp);
         if (readsize == 1) {
-            if (!header.isValid()) {
+            if (header.isV1()) {
+                Logger::log(Logger::Error, "Binlog::open: %s is binlog format v1, "
+                            "convert it with onevalue-binlog-convert", fname.c_str());
+                error = true;
+            } else if (!header.isValid()) {
                 Logger::log(Logger::Error, "Binlog::open: file invalid");
                 error = true;
             }
@@ -164,12 +411,49 @@ bool Binlog::open(const std::string &fname)
         return false;
     }
 
+    fileSize = ftell(fp);
+    fflush(fp);
+
+    //The records after the checkpoint are validated, a torn tail is cut off
+    if (!BinlogIndex::loadFromFile(&m_index, fname)) {
+        fclose(fp);
+        m_index.clear();
+        Logger::log(Logger::Error, "Binlog::open: load binlog index failed");
+        return false;
+    }
+    if (m_index.size() < (long long)fileSize) {
+        Logger::log(Logger::Warning, "Binlog::open: %s: truncate %lld bytes after the last valid record at %lld",
+                    fname.c_str(), (long long)fileSize - m_index.size(), m_index.size());
+#ifndef WIN32
+        if (ftruncate(fileno(fp), m_index.size()) != 0) {
+            fclose(fp);
+            m_index.clear();
+            Logger::log(Logger::Error, "Binlog::open: ftruncate() failed: %s", strerror(errno));
+            return false;
+        }
+#endif
+    }
+
     m_fp = fp;
     m_fileName = fname;
-    m_writtenSize = ftell(m_fp);
+    m_writtenSize = m_index.size();
+    m_checkpointSize = m_writtenSize;
+    resumeSeq(m_index.lastSeq());
     return true;
 }
 
+bool Binlog::isV1File(const std::string& fname)
+{
+    bool v1 = false;
+    FILE* fp = fopen(fname.c_str(), "rb");
+    if (fp) {
+        Header header;
+        v1 = (fread(&header, sizeof(header), 1, fp) == 1 && header.isV1());
+        fclose(fp);
+    }
+    return v1;
+}
+
 void Binlog::sync(void)
 {
     if (m_fp) {
@@ -177,46 +461,93 @@ void Binlog::sync(void)
     }
 }
 
+void Binlog::syncToDisk(void)
+{
+    if (m_fp) {
+        fflush(m_fp);
+#ifndef WIN32
+        fdatasync(fileno(m_fp));
+#endif
+    }
+}
+
 void Binlog::close(void)
 {
     if (m_fp) {
         fclose(m_fp);
+        if ((long long)m_writtenSize == m_index.size()) {
+            BinlogIndex::saveToFile(&m_index, m_fileName);
+        }
         m_fileName = std::string();
         m_writtenSize = 0;
         m_fp = NULL;
+        m_index.clear();
+    }
+}
+
+void Binlog::checkpoint(void)
+{
+    syncToDisk();
+    BinlogIndex::saveToFile(&m_index, m_fileName);
+    m_checkpointSize = m_writtenSize;
+}
+
+void Binlog::appendRecord(LogItem* item, const char* key, const char* value, unsigned int payloadCrc)
+{
+    item->timestamp = (unsigned int)time(NULL);
+    item->seal(++m_lastSeq, payloadCrc);
+
+    size_t result = fwrite(item, sizeof(LogItem), 1, m_fp);
+    result = fwrite(key, item->key_size, 1, m_fp);
+    if (item->value_size > 0) {
+        result = fwrite(value, item->value_size, 1, m_fp);
+    }
+
+    m_index.addRecord(m_writtenSize, item->item_size, item->seq);
+    m_writtenSize += item->item_size;
+    if (m_writtenSize - m_checkpointSize >= CheckpointInterval) {
+        checkpoint();
     }
 }
 
 bool Binlog::appendSetRecord(const char *key, int klen, const char *value, int vlen)
 {
-    int writesize = sizeof(LogItem) + klen + vlen;
     LogItem item;
-    item.item_size = writesize;
+    item.item_size = sizeof(LogItem) + klen + vlen;
     item.type = LogItem::SET;
     item.key_size = klen;
     item.value_size = vlen;
+    appendRecord(&item, key, value, crc32cExtend(crc32c(key, klen), value, vlen));
+    return true;
+}
 
-    size_t result = fwrite(&item, sizeof(item), 1, m_fp);
-    result = fwrite(key, klen, 1, m_fp);
-    result = fwrite(value, vlen, 1, m_fp);
+bool Binlog::appendRecords(char* buff, int size)
+{
+    for (int used = 0; used < size;) {
+        LogItem* item = (LogItem*)(buff + used);
+        item->seal(++m_lastSeq, item->crc);
+        m_index.addRecord(m_writtenSize + used, item->item_size, item->seq);
+        used += item->item_size;
+    }
 
-    m_writtenSize += writesize;
+    if (fwrite(buff, size, 1, m_fp) != 1) {
+        Logger::log(Logger::Error, "Binlog::appendRecords: fwrite() failed: %s", strerror(errno));
+    }
+    m_writtenSize += size;
+    if (m_writtenSize - m_checkpointSize >= CheckpointInterval) {
+        checkpoint();
+    }
     return true;
 }
 
 bool Binlog::appendDelRecord(const char *key, int klen)
 {
-    int writesize = sizeof(LogItem) + klen;
     LogItem item;
-    item.item_size = writesize;
+    item.item_size = sizeof(LogItem) + klen;
     item.type = LogItem::DEL;
     item.key_size = klen;
     item.value_size = 0;
-
-    size_t result = fwrite(&item, sizeof(item), 1, m_fp);
-    result = fwrite(key, klen, 1, m_fp);
-
-    m_writtenSize += writesize;
+    appendRecord(&item, key, NULL, crc32c(key, klen));
     return true;
 }
 
@@ -288,6 +619,14 @@ BinlogBufferReader BinlogParser::reader(void) const
     return BinlogBufferReader(buff, size);
 }
 
+BinlogBufferReader BinlogParser::reader(long long offset) const
+{
+    if (offset < (long long)sizeof(Binlog::Header) || offset > m_size) {
+        return reader();
+    }
+    return BinlogBufferReader(m_base + offset, m_size - (int)offset);
+}
+
 void BinlogParser::close(void)
 {
 #ifndef WIN32
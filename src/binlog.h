@@ -21,9 +21,12 @@
 #ifndef BINLOG_H
 #define BINLOG_H
 
+#include <stddef.h>
 #include <string>
 #include <vector>
 
+#include "util/crc32c.h"
+
 #include "util/locker.h"
 
 class TextConfigFile
@@ -57,17 +60,84 @@ private:
 };
 
 
+/*
+    Sparse record index of a binlog file
+
+    The offset of every Interval-th record is kept, so a record number or
+    a byte offset is resolved by reading at most Interval records instead
+    of the whole file. The index of the active binlog is maintained while
+    appending and saved to "<binlog>.idx" when the file is closed, and as
+    a checkpoint while it grows. Only the records after the checkpoint are
+    validated when the index is loaded.
+*/
+class BinlogIndex
+{
+public:
+    enum { Interval = 1024 };
+
+    BinlogIndex(void);
+    ~BinlogIndex(void);
+
+    void clear(void);
+    void addRecord(long long offset, int size, long long seq);
+
+    int recordCount(void) const { return m_recordCount; }
+    long long size(void) const { return m_size; }
+    long long lastSeq(void) const { return m_lastSeq; }
+
+    //Offset of the closest indexed record at or before the record number, *first gets its number
+    long long findRecord(int record, int* first) const;
+    //Offset of the closest indexed record at or before the offset, *first gets its number
+    long long findOffset(long long offset, int* first) const;
+
+    static bool build(BinlogIndex* index, const std::string& binlogFile);
+    //Index the valid records after index->size(), stop at the first broken one
+    static bool extend(BinlogIndex* index, const std::string& binlogFile);
+    //Load "<binlogFile>.idx" and validate the records after it, rebuild it if it is missing
+    static bool loadFromFile(BinlogIndex* index, const std::string& binlogFile);
+    static bool saveToFile(const BinlogIndex* index, const std::string& binlogFile);
+
+private:
+    struct FileHeader {
+        enum { _magic = 0xb1d0f5e8 };
+        unsigned int magic;
+        int interval;
+        int recordCount;
+        int entryCount;
+        long long size;
+        long long lastSeq;
+    };
+
+    std::vector<long long> m_offsets;   //offset of the record i*Interval
+    int m_recordCount;
+    long long m_size;                   //end of the last record
+    long long m_lastSeq;                //sequence number of the last record
+};
+
+
 class Binlog
 {
 public:
     struct Header {
-        enum { _handshake = 0x1ecdf00 };
+        enum {
+            _handshakeV1 = 0x1ecdf00,   //records without checksum
+            _handshake = 0x1ecdf02      //v2: checksummed records with sequence numbers
+        };
         int handshake;
 
         bool isValid(void) const
         { return handshake == _handshake; }
+        bool isV1(void) const
+        { return handshake == _handshakeV1; }
     };
 
+    /*
+        Binlog record (format v2)
+
+        The crc is the CRC-32C of the key and value followed by the header
+        without the crc field. seq increases by one for every record of the
+        binlog, across the files.
+    */
     struct LogItem {
         enum {
             SET,
@@ -77,29 +147,83 @@ public:
         int type;
         int key_size;
         int value_size;
+        unsigned int crc;
+        unsigned int timestamp;     //seconds since the epoch
+        long long seq;
 
         char* keyBuffer(void) { return (char*)(this+1); }
         char* valueBuffer(void) { return keyBuffer()+key_size; }
+        const char* keyBuffer(void) const { return (const char*)(this+1); }
+        const char* valueBuffer(void) const { return keyBuffer()+key_size; }
+
+        unsigned int payloadChecksum(void) const
+        { return crc32c(keyBuffer(), key_size + value_size); }
+
+        unsigned int checksum(unsigned int payloadCrc) const {
+            unsigned int c = crc32cExtend(payloadCrc, (const char*)this, offsetof(LogItem, crc));
+            return crc32cExtend(c, (const char*)&timestamp, sizeof(LogItem) - offsetof(LogItem, timestamp));
+        }
+
+        void seal(long long sequence, unsigned int payloadCrc) {
+            seq = sequence;
+            crc = checksum(payloadCrc);
+        }
+
+        //Sizes and type are consistent, the key and value are not read
+        bool hasValidHeader(void) const;
+        //The whole record is in the avail bytes and matches its checksum
+        bool isValid(long long avail) const;
+    };
+
+    //Record of the format v1 and of the __SYNC stream
+    struct LegacyLogItem {
+        int item_size;
+        int type;
+        int key_size;
+        int value_size;
+
+        char* keyBuffer(void) { return (char*)(this+1); }
+        char* valueBuffer(void) { return keyBuffer()+key_size; }
+    };
+
+    enum {
+        CheckpointInterval = 8*1024*1024    //index checkpoint every 8M
     };
 
     Binlog(void);
     ~Binlog(void);
 
+    //Truncate the records after the last valid one, the file must be format v2
     bool open(const std::string& fname);
+    static bool isV1File(const std::string& fname);
 
     std::string fileName(void) const { return m_fileName; }
     size_t writtenSize(void) const { return m_writtenSize; }
+    const BinlogIndex* index(void) const { return &m_index; }
+    long long lastSeq(void) const { return m_lastSeq; }
+    //Continue the sequence of a previous file
+    void resumeSeq(long long seq) { if (seq > m_lastSeq) m_lastSeq = seq; }
 
     void sync(void);
+    //Flush and fdatasync
+    void syncToDisk(void);
     void close(void);
 
     bool appendSetRecord(const char* key, int klen, const char* value, int vlen);
     bool appendDelRecord(const char* key, int klen);
+    //Append complete log items, the crc field holds the payload checksum until they are sealed here
+    bool appendRecords(char* buff, int size);
 
 private:
+    void appendRecord(LogItem* item, const char* key, const char* value, unsigned int payloadCrc);
+    void checkpoint(void);
+
     std::string m_fileName;
     FILE* m_fp;
     size_t m_writtenSize;
+    BinlogIndex m_index;
+    long long m_lastSeq;
+    size_t m_checkpointSize;
     Binlog(const Binlog&);
     Binlog& operator=(const Binlog&);
 };
@@ -123,15 +247,16 @@ struct BinlogSyncStream {
     int lastUpdatePos;      //last update in the binlog
     int logItemCount;       //item count
 
-    Binlog::LogItem* firstLogItem(void) {
-        return (Binlog::LogItem*)(this+1);
+    Binlog::LegacyLogItem* firstLogItem(void) {
+        return (Binlog::LegacyLogItem*)(this+1);
     }
 
-    Binlog::LogItem* nextLogItem(Binlog::LogItem* cur) {
-        return (Binlog::LogItem*)(((char*)cur)+cur->item_size);
+    Binlog::LegacyLogItem* nextLogItem(Binlog::LegacyLogItem* cur) {
+        return (Binlog::LegacyLogItem*)(((char*)cur)+cur->item_size);
     } 
 };
 
+/* Iterate the valid records of a buffer, stop at the end or at a broken record */
 class BinlogBufferReader
 {
 public:
@@ -147,18 +272,20 @@ public:
     {}
 
     Binlog::LogItem* firstItem(void) const {
-        if (m_len == 0) {
-            return NULL;
-        }
-        return (Binlog::LogItem*)(m_buff);
+        return itemAt(0);
     }
     Binlog::LogItem* nextItem(Binlog::LogItem* item) const {
-        if ((char*)item + item->item_size - m_buff >= m_len) {
+        return itemAt((char*)item - m_buff + item->item_size);
+    }
+private:
+    Binlog::LogItem* itemAt(long long offset) const {
+        if (offset >= m_len) {
             return NULL;
         }
-        return (Binlog::LogItem*)(((char*)item)+item->item_size);
+        Binlog::LogItem* item = (Binlog::LogItem*)(m_buff + offset);
+        return item->isValid(m_len - offset) ? item : NULL;
     }
-private:
+
     char* m_buff;
     int m_len;
 };
@@ -172,6 +299,9 @@ public:
 
     bool open(const std::string& fname);
     BinlogBufferReader reader(void) const;
+    //Reader of the records starting at the file offset
+    BinlogBufferReader reader(long long offset) const;
+    int size(void) const { return m_size; }
     void close(void);
 
 private:
@@ -0,0 +1,412 @@
+﻿/*
+* Licensed to the Apache Software Foundation (ASF) under one
+* or more contributor license agreements.  See the NOTICE file
+* distributed with this work for additional information
+* regarding copyright ownership.  The ASF licenses this file
+* to you under the Apache License, Version 2.0 (the
+* "License"); you may not use this file except in compliance
+* with the License.  You may obtain a copy of the License at
+*
+*   http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing,
+* software distributed under the License is distributed on an
+* "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+* KIND, either express or implied.  See the License for the
+* specific language governing permissions and limitations
+* under the License.
+*/
+
+#ifndef WIN32
+#include <sys/time.h>
+#endif
+
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "util/thread.h"
+#include "util/logger.h"
+#include "binlogwriter.h"
+
+#ifdef WIN32
+#define THREAD_LOCAL __declspec(thread)
+#else
+#define THREAD_LOCAL __thread
+#endif
+
+static long long currentUsec(void)
+{
+#ifdef WIN32
+    return (long long)::GetTickCount() * 1000;
+#else
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return (long long)tv.tv_sec * 1000000 + tv.tv_usec;
+#endif
+}
+
+struct BinlogRecord {
+    unsigned long long seq;
+    int size;                   //log item size
+
+    Binlog::LogItem* item(void) { return (Binlog::LogItem*)(this + 1); }
+
+    static BinlogRecord* alloc(int type, const char* key, int klen, const char* value, int vlen) {
+        int size = sizeof(Binlog::LogItem) + klen + vlen;
+        BinlogRecord* record = (BinlogRecord*)malloc(sizeof(BinlogRecord) + size);
+        record->size = size;
+        Binlog::LogItem* item = record->item();
+        item->item_size = size;
+        item->type = type;
+        item->key_size = klen;
+        item->value_size = vlen;
+        item->timestamp = (unsigned int)time(NULL);
+        item->seq = 0;
+        memcpy(item->keyBuffer(), key, klen);
+        if (vlen > 0) {
+            memcpy(item->valueBuffer(), value, vlen);
+        }
+        //The checksum of the payload is computed by the producer, Binlog seals the record
+        item->crc = item->payloadChecksum();
+        return record;
+    }
+};
+
+/* Single-producer single-consumer ring, the producer is a write thread and the consumer the writer */
+class BinlogProducerQueue
+{
+public:
+    BinlogProducerQueue(int capacity) :
+        m_capacity(capacity),
+        m_head(0),
+        m_tail(0)
+    {
+        m_slots = new BinlogRecord*[capacity];
+    }
+    ~BinlogProducerQueue(void) {
+        for (BinlogRecord* record = pop(); record != NULL; record = pop()) {
+            free(record);
+        }
+        delete []m_slots;
+    }
+
+    bool isFull(void) const { return m_tail - m_head >= (unsigned long long)m_capacity; }
+    long long size(void) const { return (long long)(m_tail - m_head); }
+
+    void push(BinlogRecord* record) {
+        unsigned long long tail = m_tail;
+        m_slots[tail % m_capacity] = record;
+        __sync_synchronize();
+        m_tail = tail + 1;
+    }
+
+    BinlogRecord* pop(void) {
+        unsigned long long head = m_head;
+        if (head == m_tail) {
+            return NULL;
+        }
+        __sync_synchronize();
+        BinlogRecord* record = m_slots[head % m_capacity];
+        __sync_synchronize();
+        m_head = head + 1;
+        return record;
+    }
+
+private:
+    int m_capacity;
+    BinlogRecord** m_slots;
+    volatile unsigned long long m_head;
+    volatile unsigned long long m_tail;
+};
+
+static THREAD_LOCAL BinlogProducerQueue* t_queue = NULL;
+static THREAD_LOCAL BinlogWriter* t_queueOwner = NULL;
+
+
+class BinlogWriterThread : public Thread
+{
+public:
+    BinlogWriterThread(BinlogWriter* writer) : m_writer(writer) {}
+    ~BinlogWriterThread(void) {}
+
+protected:
+    virtual void run(void) { m_writer->run(); }
+
+private:
+    BinlogWriter* m_writer;
+};
+
+
+BinlogWriter::BinlogWriter(LeveldbCluster* cluster) :
+    m_cluster(cluster),
+    m_thread(NULL),
+    m_running(false),
+    m_stopping(false),
+    m_seq(0),
+    m_nextSeq(1),
+    m_batchRecords(0),
+    m_unsynced(false),
+    m_wakeCond(&m_wakeLock),
+    m_sleeping(0),
+    m_pendingCount(0),
+    m_records(0),
+    m_batches(0),
+    m_bytes(0),
+    m_syncs(0),
+    m_lastFlushUsec(0),
+    m_maxFlushUsec(0),
+    m_totalFlushUsec(0)
+{
+}
+
+BinlogWriter::~BinlogWriter(void)
+{
+    stop();
+    for (unsigned int i = 0; i < m_queues.size(); ++i) {
+        delete m_queues[i];
+    }
+}
+
+const char* BinlogWriter::syncModeName(int mode)
+{
+    switch (mode) {
+    case SyncInterval:
+        return "interval";
+    case SyncBatch:
+        return "batch";
+    default:
+        return "none";
+    }
+}
+
+void BinlogWriter::start(void)
+{
+    if (m_running || !m_option.enabled) {
+        return;
+    }
+    m_stopping = false;
+    m_nextSeq = m_seq + 1;
+    m_thread = new BinlogWriterThread(this);
+    m_running = true;
+    m_thread->start();
+    Logger::log(Logger::Message, "Binlog writer started. sync=%s sync_interval=%dms",
+                syncModeName(m_option.syncMode), m_option.syncInterval);
+}
+
+void BinlogWriter::stop(void)
+{
+    if (!m_running) {
+        return;
+    }
+    m_stopping = true;
+    wakeup();
+    m_thread->join();
+    delete m_thread;
+    m_thread = NULL;
+    m_running = false;
+}
+
+void BinlogWriter::appendSetRecord(const char* key, int klen, const char* value, int vlen)
+{
+    append(BinlogRecord::alloc(Binlog::LogItem::SET, key, klen, value, vlen));
+}
+
+void BinlogWriter::appendDelRecord(const char* key, int klen)
+{
+    append(BinlogRecord::alloc(Binlog::LogItem::DEL, key, klen, NULL, 0));
+}
+
+BinlogProducerQueue* BinlogWriter::localQueue(void)
+{
+    if (t_queueOwner != this) {
+        BinlogProducerQueue* queue = new BinlogProducerQueue(m_option.queueSize);
+        m_queueLock.lock();
+        m_queues.push_back(queue);
+        m_queueLock.unlock();
+        t_queue = queue;
+        t_queueOwner = this;
+    }
+    return t_queue;
+}
+
+void BinlogWriter::append(BinlogRecord* record)
+{
+    BinlogProducerQueue* queue = localQueue();
+
+    //The record is numbered once it is sure to fit, so the writer never waits on a full queue
+    while (queue->isFull()) {
+        wakeup();
+        Thread::sleep(1);
+    }
+    record->seq = __sync_add_and_fetch(&m_seq, 1);
+    queue->push(record);
+
+    __sync_synchronize();
+    if (m_sleeping) {
+        wakeup();
+    }
+}
+
+void BinlogWriter::wakeup(void)
+{
+    m_wakeLock.lock();
+    m_wakeCond.signal();
+    m_wakeLock.unlock();
+}
+
+bool BinlogWriter::drainQueues(void)
+{
+    bool drained = false;
+    m_queueLock.lock();
+    for (unsigned int i = 0; i < m_queues.size(); ++i) {
+        BinlogProducerQueue* queue = m_queues[i];
+        for (BinlogRecord* record = queue->pop(); record != NULL; record = queue->pop()) {
+            m_pending.insert(std::make_pair(record->seq, record));
+            drained = true;
+        }
+    }
+    m_queueLock.unlock();
+    m_pendingCount = m_pending.size();
+    return drained;
+}
+
+bool BinlogWriter::queuesEmpty(void)
+{
+    bool empty = true;
+    m_queueLock.lock();
+    for (unsigned int i = 0; i < m_queues.size() && empty; ++i) {
+        empty = (m_queues[i]->size() == 0);
+    }
+    m_queueLock.unlock();
+    return empty;
+}
+
+void BinlogWriter::run(void)
+{
+    enum {
+        IdleWait = 100,         //msec
+        GapTimeout = 1000000    //usec
+    };
+
+    long long lastSync = currentUsec();
+    long long gapSince = 0;
+    while (true) {
+        drainQueues();
+
+        //Records are written strictly in numbering order
+        m_batch.clear();
+        m_batchRecords = 0;
+        while (!m_pending.empty() && (int)m_batch.size() < m_option.maxBatchSize) {
+            std::map<unsigned long long, BinlogRecord*>::iterator it = m_pending.begin();
+            if (it->first != m_nextSeq) {
+                break;
+            }
+            BinlogRecord* record = it->second;
+            m_batch.append((char*)record->item(), record->size);
+            ++m_batchRecords;
+            free(record);
+            m_pending.erase(it);
+            ++m_nextSeq;
+        }
+        m_pendingCount = m_pending.size();
+
+        long long now = currentUsec();
+        if (!m_batch.empty()) {
+            flushBatch();
+            gapSince = 0;
+        } else if (!m_pending.empty()) {
+            //A numbered record is not queued yet, its thread is between numbering and pushing.
+            //A thread cancelled right there would stall the binlog, so give up on it after a while
+            if (gapSince == 0) {
+                gapSince = now;
+            } else if (now - gapSince > GapTimeout || (m_stopping && queuesEmpty())) {
+                Logger::log(Logger::Warning, "BinlogWriter: records %llu-%llu never queued, skipped",
+                            m_nextSeq, m_pending.begin()->first - 1);
+                m_nextSeq = m_pending.begin()->first;
+                gapSince = 0;
+            }
+            Thread::sleep(0);
+            continue;
+        }
+
+        if (m_unsynced && m_option.syncMode == SyncInterval &&
+                now - lastSync >= (long long)m_option.syncInterval * 1000) {
+            syncFile();
+            lastSync = now;
+        }
+        if (!m_batch.empty()) {
+            continue;
+        }
+
+        if (m_stopping && queuesEmpty()) {
+            break;
+        }
+
+        int waitMsec = IdleWait;
+        if (m_unsynced && m_option.syncMode == SyncInterval) {
+            long long left = (long long)m_option.syncInterval - (now - lastSync) / 1000;
+            waitMsec = (left < 1) ? 1 : (left < waitMsec ? (int)left : waitMsec);
+        }
+        m_wakeLock.lock();
+        m_sleeping = 1;
+        __sync_synchronize();
+        if (!m_stopping && queuesEmpty()) {
+            m_wakeCond.wait(waitMsec);
+        }
+        m_sleeping = 0;
+        m_wakeLock.unlock();
+    }
+
+    if (m_unsynced && m_option.syncMode != SyncNone) {
+        syncFile();
+    }
+}
+
+void BinlogWriter::flushBatch(void)
+{
+    long long start = currentUsec();
+    bool sync = (m_option.syncMode == SyncBatch);
+    m_cluster->appendBinlogBatch(&m_batch[0], m_batch.size(), sync);
+    long long elapsed = currentUsec() - start;
+
+    m_records += m_batchRecords;
+    m_bytes += m_batch.size();
+    ++m_batches;
+    if (sync) {
+        ++m_syncs;
+    } else {
+        m_unsynced = true;
+    }
+    m_lastFlushUsec = elapsed;
+    m_totalFlushUsec += elapsed;
+    if (elapsed > m_maxFlushUsec) {
+        m_maxFlushUsec = elapsed;
+    }
+}
+
+void BinlogWriter::syncFile(void)
+{
+    m_cluster->syncBinlog();
+    m_unsynced = false;
+    ++m_syncs;
+}
+
+void BinlogWriter::stats(Stats* stats)
+{
+    long long depth = m_pendingCount;
+    m_queueLock.lock();
+    for (unsigned int i = 0; i < m_queues.size(); ++i) {
+        depth += m_queues[i]->size();
+    }
+    m_queueLock.unlock();
+
+    stats->records = m_records;
+    stats->batches = m_batches;
+    stats->bytes = m_bytes;
+    stats->syncs = m_syncs;
+    stats->queueDepth = depth;
+    stats->lastFlushUsec = m_lastFlushUsec;
+    stats->maxFlushUsec = m_maxFlushUsec;
+    stats->avgFlushUsec = (m_batches > 0) ? (long long)(m_totalFlushUsec / m_batches) : 0;
+}
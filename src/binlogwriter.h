@@ -0,0 +1,141 @@
+﻿/*
+* Licensed to the Apache Software Foundation (ASF) under one
+* or more contributor license agreements.  See the NOTICE file
+* distributed with this work for additional information
+* regarding copyright ownership.  The ASF licenses this file
+* to you under the Apache License, Version 2.0 (the
+* "License"); you may not use this file except in compliance
+* with the License.  You may obtain a copy of the License at
+*
+*   http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing,
+* software distributed under the License is distributed on an
+* "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+* KIND, either express or implied.  See the License for the
+* specific language governing permissions and limitations
+* under the License.
+*/
+
+#ifndef BINLOGWRITER_H
+#define BINLOGWRITER_H
+
+#include <string>
+#include <vector>
+#include <map>
+
+#include "util/locker.h"
+#include "leveldb.h"
+
+/*
+    Group-committed binlog writer
+
+    Every write thread hands its binlog records to its own single-producer
+    queue instead of locking the binlog file. The writer thread merges the
+    queues in the order the records were numbered, appends them to the
+    binlog in large batches and syncs the file according to the sync mode.
+*/
+struct BinlogRecord;
+class BinlogProducerQueue;
+class BinlogWriterThread;
+class BinlogWriter
+{
+public:
+    enum SyncMode {
+        SyncNone = 0,           //left to the OS
+        SyncInterval = 1,       //fdatasync every syncInterval msec
+        SyncBatch = 2           //fdatasync after every batch
+    };
+
+    struct Option {
+        bool enabled;
+        int syncMode;
+        int syncInterval;       //msec
+        int queueSize;          //records per write thread
+        int maxBatchSize;       //bytes
+
+        Option(void) {
+            enabled = true;
+            syncMode = SyncNone;
+            syncInterval = 1000;
+            queueSize = 4096;
+            maxBatchSize = 4 * 1024 * 1024;
+        }
+    };
+
+    struct Stats {
+        unsigned long long records;
+        unsigned long long batches;
+        unsigned long long bytes;
+        unsigned long long syncs;
+        long long queueDepth;
+        long long lastFlushUsec;
+        long long maxFlushUsec;
+        long long avgFlushUsec;
+    };
+
+    BinlogWriter(LeveldbCluster* cluster);
+    ~BinlogWriter(void);
+
+    void setOption(const Option& opt) { m_option = opt; }
+    const Option& option(void) const { return m_option; }
+    bool isRunning(void) const { return m_running; }
+
+    void start(void);
+    //Write the queued records and stop
+    void stop(void);
+
+    void appendSetRecord(const char* key, int klen, const char* value, int vlen);
+    void appendDelRecord(const char* key, int klen);
+
+    void stats(Stats* stats);
+
+    static const char* syncModeName(int mode);
+
+private:
+    BinlogProducerQueue* localQueue(void);
+    void append(BinlogRecord* record);
+    void wakeup(void);
+    void run(void);
+    bool drainQueues(void);
+    bool queuesEmpty(void);
+    void flushBatch(void);
+    void syncFile(void);
+
+private:
+    LeveldbCluster* m_cluster;
+    Option m_option;
+    BinlogWriterThread* m_thread;
+    volatile bool m_running;
+    volatile bool m_stopping;
+
+    unsigned long long m_seq;           //last numbered record
+    unsigned long long m_nextSeq;       //next record to write
+    Mutex m_queueLock;
+    std::vector<BinlogProducerQueue*> m_queues;
+
+    //Writer thread only
+    std::map<unsigned long long, BinlogRecord*> m_pending;
+    std::string m_batch;
+    int m_batchRecords;
+    bool m_unsynced;
+
+    Mutex m_wakeLock;
+    Condition m_wakeCond;
+    volatile int m_sleeping;
+
+    volatile long long m_pendingCount;
+    unsigned long long m_records;
+    unsigned long long m_batches;
+    unsigned long long m_bytes;
+    unsigned long long m_syncs;
+    long long m_lastFlushUsec;
+    long long m_maxFlushUsec;
+    long long m_totalFlushUsec;
+
+    friend class BinlogWriterThread;
+    BinlogWriter(const BinlogWriter&);
+    BinlogWriter& operator=(const BinlogWriter&);
+};
+
+#endif
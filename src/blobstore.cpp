@@ -0,0 +1,614 @@
+﻿/*
+* Licensed to the Apache Software Foundation (ASF) under one
+* or more contributor license agreements.  See the NOTICE file
+* distributed with this work for additional information
+* regarding copyright ownership.  The ASF licenses this file
+* to you under the Apache License, Version 2.0 (the
+* "License"); you may not use this file except in compliance
+* with the License.  You may obtain a copy of the License at
+*
+*   http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing,
+* software distributed under the License is distributed on an
+* "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+* KIND, either express or implied.  See the License for the
+* specific language governing permissions and limitations
+* under the License.
+*/
+
+#ifndef WIN32
+#include <fcntl.h>
+#include <errno.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#endif
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stddef.h>
+
+#include "util/thread.h"
+#include "util/logger.h"
+#include "t_redis.h"
+#include "blobstore.h"
+
+struct BlobRecord {
+    enum { _magic = 0x0b10b1e5 };
+    int magic;
+    unsigned int keyLen;
+    unsigned int mappingLen;        //0: mapping key is the key
+    unsigned int valueLen;
+    unsigned int valueChecksum;
+};
+
+class BlobFile
+{
+public:
+    BlobFile(unsigned int no, int _fd) : fileNo(no), fd(_fd), refs(0), obsolete(false) {}
+    ~BlobFile(void) {
+#ifndef WIN32
+        if (fd >= 0) {
+            ::close(fd);
+        }
+#endif
+    }
+
+    unsigned int fileNo;
+    int fd;
+    int refs;
+    bool obsolete;
+};
+
+class BlobGCThread : public Thread
+{
+public:
+    BlobGCThread(BlobStore* store) : m_store(store) {}
+    ~BlobGCThread(void) {}
+
+    virtual void run(void) {
+        while (true) {
+            Thread::sleep(m_store->m_option.gcInterval * 1000);
+            m_store->collect();
+        }
+    }
+
+private:
+    BlobStore* m_store;
+};
+
+
+static unsigned int pointerChecksum(const BlobPointer* ptr)
+{
+    return hashForBytes((const char*)ptr, offsetof(BlobPointer, checksum));
+}
+
+static bool readFully(int fd, char* buf, size_t size, unsigned long long offset)
+{
+#ifndef WIN32
+    while (size > 0) {
+        ssize_t n = ::pread(fd, buf, size, offset);
+        if (n <= 0) {
+            if (n < 0 && errno == EINTR) {
+                continue;
+            }
+            return false;
+        }
+        buf += n;
+        size -= n;
+        offset += n;
+    }
+    return true;
+#else
+    (void)fd;
+    (void)buf;
+    (void)size;
+    (void)offset;
+    return false;
+#endif
+}
+
+
+BlobStore::BlobStore(LeveldbCluster* dbCluster)
+{
+    m_dbCluster = dbCluster;
+    m_gcThread = new BlobGCThread(this);
+    m_opened = false;
+    m_activeFd = -1;
+    m_activeFileNo = 0;
+    m_activeSize = 0;
+    m_lastCollected = 0;
+    m_gcRuns = 0;
+    m_gcRewrittenBytes = 0;
+    m_gcRemovedFiles = 0;
+}
+
+BlobStore::~BlobStore(void)
+{
+    close();
+    delete m_gcThread;
+}
+
+std::string BlobStore::blobFileName(unsigned int fileNo) const
+{
+    char buff[32];
+    sprintf(buff, "/%06u.blob", fileNo);
+    return m_dir + buff;
+}
+
+bool BlobStore::open(const std::string& dir)
+{
+#ifndef WIN32
+    if (m_opened) {
+        return true;
+    }
+
+    m_dir = dir;
+    DIR* d = ::opendir(dir.c_str());
+    if (!d) {
+        if (!m_option.enabled) {
+            return true;
+        }
+        if (::mkdir(dir.c_str(), 0755) != 0) {
+            Logger::log(Logger::Error, "BlobStore::open: can't create directory '%s': %s",
+                        dir.c_str(), strerror(errno));
+            return false;
+        }
+    } else {
+        dirent* ent;
+        while ((ent = ::readdir(d)) != NULL) {
+            unsigned int fileNo;
+            char suffix[8];
+            if (sscanf(ent->d_name, "%u.%5s", &fileNo, suffix) != 2 || strcmp(suffix, "blob") != 0) {
+                continue;
+            }
+            std::string fname = blobFileName(fileNo);
+            int fd = ::open(fname.c_str(), O_RDONLY);
+            if (fd < 0) {
+                Logger::log(Logger::Error, "BlobStore::open: can't open '%s': %s",
+                            fname.c_str(), strerror(errno));
+                continue;
+            }
+            m_files[fileNo] = new BlobFile(fileNo, fd);
+            if (fileNo >= m_activeFileNo) {
+                m_activeFileNo = fileNo;
+            }
+        }
+        ::closedir(d);
+    }
+
+    //Never append to an old file, its tail may be a torn record
+    m_activeFileNo++;
+    m_opened = true;
+    Logger::log(Logger::Message, "Blob store '%s' opened. files=%d enabled=%s min_blob_size=%uKB",
+                m_dir.c_str(), (int)m_files.size(),
+                m_option.enabled ? "true" : "false",
+                m_option.minBlobSize / 1024);
+    return true;
+#else
+    (void)dir;
+    return false;
+#endif
+}
+
+void BlobStore::close(void)
+{
+#ifndef WIN32
+    m_writeLock.lock();
+    if (m_activeFd >= 0) {
+        ::close(m_activeFd);
+        m_activeFd = -1;
+    }
+    m_writeLock.unlock();
+#endif
+
+    m_filesLock.lock();
+    std::map<unsigned int, BlobFile*>::iterator it = m_files.begin();
+    for (; it != m_files.end(); ++it) {
+        delete it->second;
+    }
+    m_files.clear();
+    m_filesLock.unlock();
+    m_opened = false;
+}
+
+void BlobStore::start(void)
+{
+    if (m_opened && m_option.enabled) {
+        m_gcThread->start();
+    }
+}
+
+void BlobStore::stop(void)
+{
+    m_gcThread->terminate();
+}
+
+bool BlobStore::isBlobKey(const XObject& key)
+{
+    if (key.len < (int)sizeof(short)) {
+        return false;
+    }
+    short type = *((short*)key.data);
+    return type == T_KV || type == T_StringChunk;
+}
+
+bool BlobStore::shouldSeparate(const XObject& key, const XObject& val) const
+{
+    return m_opened && m_option.enabled
+            && (size_t)val.len >= m_option.minBlobSize
+            && isBlobKey(key);
+}
+
+bool BlobStore::isPointer(const char* data, int len)
+{
+    if (len != (int)sizeof(BlobPointer)) {
+        return false;
+    }
+    BlobPointer ptr;
+    memcpy(&ptr, data, sizeof(ptr));
+    return ptr.magic == BlobPointer::_magic && ptr.checksum == pointerChecksum(&ptr);
+}
+
+bool BlobStore::openActiveFile(unsigned int fileNo)
+{
+#ifndef WIN32
+    std::string fname = blobFileName(fileNo);
+    int wfd = ::open(fname.c_str(), O_WRONLY | O_CREAT | O_APPEND, 0644);
+    if (wfd < 0) {
+        Logger::log(Logger::Error, "BlobStore: can't create '%s': %s", fname.c_str(), strerror(errno));
+        return false;
+    }
+    int rfd = ::open(fname.c_str(), O_RDONLY);
+    if (rfd < 0) {
+        ::close(wfd);
+        Logger::log(Logger::Error, "BlobStore: can't open '%s': %s", fname.c_str(), strerror(errno));
+        return false;
+    }
+
+    m_filesLock.lock();
+    m_files[fileNo] = new BlobFile(fileNo, rfd);
+    m_filesLock.unlock();
+
+    m_activeFd = wfd;
+    m_activeFileNo = fileNo;
+    m_activeSize = ::lseek(wfd, 0, SEEK_END);
+    return true;
+#else
+    (void)fileNo;
+    return false;
+#endif
+}
+
+bool BlobStore::put(const XObject& key, const XObject& mappingKey, const XObject& val,
+                    BlobPointer* ptr, bool sync)
+{
+#ifndef WIN32
+    BlobRecord record;
+    record.magic = BlobRecord::_magic;
+    record.keyLen = key.len;
+    record.mappingLen = mappingKey.isNull() ? 0 : mappingKey.len;
+    record.valueLen = val.len;
+    record.valueChecksum = hashForBytes(val.data, val.len);
+
+    iovec iov[4];
+    iov[0].iov_base = &record;
+    iov[0].iov_len = sizeof(record);
+    iov[1].iov_base = key.data;
+    iov[1].iov_len = key.len;
+    iov[2].iov_base = mappingKey.data;
+    iov[2].iov_len = record.mappingLen;
+    iov[3].iov_base = val.data;
+    iov[3].iov_len = val.len;
+    size_t total = sizeof(record) + record.keyLen + record.mappingLen + record.valueLen;
+
+    m_writeLock.lock();
+    if (m_activeFd < 0 && !openActiveFile(m_activeFileNo)) {
+        m_writeLock.unlock();
+        return false;
+    }
+
+    unsigned long long offset = m_activeSize;
+    ssize_t n = ::writev(m_activeFd, iov, 4);
+    if (n != (ssize_t)total) {
+        Logger::log(Logger::Error, "BlobStore::put: writev() failed: %s", strerror(errno));
+        //Drop the torn tail, the next write goes to a new file
+        ::close(m_activeFd);
+        m_activeFd = -1;
+        m_activeFileNo++;
+        m_writeLock.unlock();
+        return false;
+    }
+    if (sync || m_option.sync) {
+        ::fdatasync(m_activeFd);
+    }
+
+    memset(ptr, 0, sizeof(BlobPointer));
+    ptr->magic = BlobPointer::_magic;
+    ptr->fileNo = m_activeFileNo;
+    ptr->offset = offset + sizeof(record) + record.keyLen + record.mappingLen;
+    ptr->size = record.valueLen;
+    ptr->valueChecksum = record.valueChecksum;
+    ptr->checksum = pointerChecksum(ptr);
+
+    m_activeSize += total;
+    if (m_activeSize >= m_option.maxFileSize) {
+        ::close(m_activeFd);
+        m_activeFd = -1;
+        m_activeFileNo++;
+    }
+    m_writeLock.unlock();
+    return true;
+#else
+    (void)key;
+    (void)mappingKey;
+    (void)val;
+    (void)ptr;
+    (void)sync;
+    return false;
+#endif
+}
+
+BlobFile* BlobStore::acquireFile(unsigned int fileNo)
+{
+    BlobFile* file = NULL;
+    m_filesLock.lock();
+    std::map<unsigned int, BlobFile*>::iterator it = m_files.find(fileNo);
+    if (it != m_files.end()) {
+        file = it->second;
+        file->refs++;
+    }
+    m_filesLock.unlock();
+    return file;
+}
+
+void BlobStore::releaseFile(BlobFile* file)
+{
+    m_filesLock.lock();
+    file->refs--;
+    bool destroy = (file->obsolete && file->refs == 0);
+    m_filesLock.unlock();
+    if (destroy) {
+        delete file;
+    }
+}
+
+void BlobStore::removeFile(unsigned int fileNo)
+{
+    BlobFile* destroy = NULL;
+    m_filesLock.lock();
+    std::map<unsigned int, BlobFile*>::iterator it = m_files.find(fileNo);
+    if (it != m_files.end()) {
+        BlobFile* file = it->second;
+        m_files.erase(it);
+        file->obsolete = true;
+        if (file->refs == 0) {
+            destroy = file;
+        }
+    }
+    m_filesLock.unlock();
+    delete destroy;
+
+#ifndef WIN32
+    std::string fname = blobFileName(fileNo);
+    if (::unlink(fname.c_str()) != 0) {
+        Logger::log(Logger::Warning, "BlobStore: can't remove '%s': %s", fname.c_str(), strerror(errno));
+    }
+#endif
+}
+
+bool BlobStore::read(const BlobPointer& ptr, std::string& val)
+{
+    BlobFile* file = acquireFile(ptr.fileNo);
+    if (!file) {
+        return false;
+    }
+
+    std::string buf;
+    buf.resize(ptr.size);
+    bool ok = readFully(file->fd, (char*)buf.data(), ptr.size, ptr.offset);
+    releaseFile(file);
+
+    if (!ok || hashForBytes(buf.data(), buf.size()) != ptr.valueChecksum) {
+        Logger::log(Logger::Error, "BlobStore::read: bad blob (file=%u offset=%llu size=%u)",
+                    ptr.fileNo, ptr.offset, ptr.size);
+        return false;
+    }
+    val.swap(buf);
+    return true;
+}
+
+bool BlobStore::resolve(std::string& val)
+{
+    if (!isPointer(val)) {
+        return true;
+    }
+    BlobPointer ptr;
+    memcpy(&ptr, val.data(), sizeof(ptr));
+    return read(ptr, val);
+}
+
+void BlobStore::lockKey(const XObject& key)
+{
+    m_keyLock[hashForBytes(key.data, key.len) % KeyLockSize].lock();
+}
+
+void BlobStore::unlockKey(const XObject& key)
+{
+    m_keyLock[hashForBytes(key.data, key.len) % KeyLockSize].unlock();
+}
+
+int BlobStore::fileCount(void)
+{
+    m_filesLock.lock();
+    int count = m_files.size();
+    m_filesLock.unlock();
+    return count;
+}
+
+unsigned long long BlobStore::totalSize(void)
+{
+    unsigned long long size = 0;
+#ifndef WIN32
+    m_filesLock.lock();
+    std::map<unsigned int, BlobFile*>::iterator it = m_files.begin();
+    for (; it != m_files.end(); ++it) {
+        struct stat st;
+        if (::fstat(it->second->fd, &st) == 0) {
+            size += st.st_size;
+        }
+    }
+    m_filesLock.unlock();
+#endif
+    return size;
+}
+
+/*
+    Every round examines a few sealed files after the last one examined,
+    the live records of a file are those whose key still points to them
+*/
+void BlobStore::collect(void)
+{
+    enum { FilesPerRound = 4 };
+
+    m_writeLock.lock();
+    unsigned int activeFileNo = m_activeFileNo;
+    m_writeLock.unlock();
+
+    std::vector<unsigned int> sealed;
+    m_filesLock.lock();
+    std::map<unsigned int, BlobFile*>::iterator it = m_files.begin();
+    for (; it != m_files.end(); ++it) {
+        if (it->first < activeFileNo) {
+            sealed.push_back(it->first);
+        }
+    }
+    m_filesLock.unlock();
+
+    if (sealed.empty()) {
+        return;
+    }
+
+    unsigned int start = 0;
+    while (start < sealed.size() && sealed[start] <= m_lastCollected) {
+        ++start;
+    }
+
+    int count = (int)sealed.size() < FilesPerRound ? (int)sealed.size() : FilesPerRound;
+    for (int i = 0; i < count; ++i) {
+        unsigned int fileNo = sealed[(start + i) % sealed.size()];
+        m_lastCollected = fileNo;
+
+        int garbageRatio = 0;
+        if (!collectFile(fileNo, false, &garbageRatio)) {
+            continue;
+        }
+        if (garbageRatio < m_option.gcRatio) {
+            continue;
+        }
+
+        Logger::log(Logger::Message, "BlobStore: collecting file %u (%d%% garbage)", fileNo, garbageRatio);
+        if (collectFile(fileNo, true, &garbageRatio)) {
+            removeFile(fileNo);
+            __sync_fetch_and_add(&m_gcRemovedFiles, 1);
+        }
+    }
+    __sync_fetch_and_add(&m_gcRuns, 1);
+}
+
+bool BlobStore::collectFile(unsigned int fileNo, bool rewrite, int* garbageRatio)
+{
+    std::string fname = blobFileName(fileNo);
+    FILE* fp = fopen(fname.c_str(), "rb");
+    if (!fp) {
+        return false;
+    }
+
+    unsigned long long offset = 0;
+    unsigned long long liveBytes = 0;
+    bool ok = true;
+    std::string key, mapping, value, cur;
+    while (ok) {
+        BlobRecord record;
+        if (fread(&record, sizeof(record), 1, fp) != 1 || record.magic != BlobRecord::_magic) {
+            //End of file or a torn tail
+            break;
+        }
+        key.resize(record.keyLen);
+        mapping.resize(record.mappingLen);
+        if ((record.keyLen > 0 && fread((char*)key.data(), record.keyLen, 1, fp) != 1) ||
+                (record.mappingLen > 0 && fread((char*)mapping.data(), record.mappingLen, 1, fp) != 1)) {
+            break;
+        }
+
+        BlobPointer loc;
+        loc.fileNo = fileNo;
+        loc.offset = offset + sizeof(record) + record.keyLen + record.mappingLen;
+        unsigned long long recordSize = loc.offset + record.valueLen - offset;
+        offset += recordSize;
+
+        XObject _key(key.data(), key.size());
+        XObject _mapping = mapping.empty() ? _key : XObject(mapping.data(), mapping.size());
+        Leveldb* db = m_dbCluster->mapToDatabase(_mapping.data, _mapping.len);
+        if (!db) {
+            ok = false;
+            break;
+        }
+
+        if (rewrite) {
+            value.resize(record.valueLen);
+            if (record.valueLen > 0 && fread((char*)value.data(), record.valueLen, 1, fp) != 1) {
+                break;
+            }
+        } else if (fseek(fp, record.valueLen, SEEK_CUR) != 0) {
+            break;
+        }
+
+        if (!rewrite) {
+            if (db->value(_key, cur) && isPointer(cur)) {
+                BlobPointer ptr;
+                memcpy(&ptr, cur.data(), sizeof(ptr));
+                if (ptr.isSameLocation(loc)) {
+                    liveBytes += recordSize;
+                }
+            }
+            continue;
+        }
+
+        lockKey(_key);
+        if (db->value(_key, cur) && isPointer(cur)) {
+            BlobPointer ptr;
+            memcpy(&ptr, cur.data(), sizeof(ptr));
+            if (ptr.isSameLocation(loc)) {
+                BlobPointer newPtr;
+                XObject _value(value.data(), value.size());
+                if (hashForBytes(value.data(), value.size()) != record.valueChecksum ||
+                        !put(_key, mapping.empty() ? XObject() : _mapping, _value, &newPtr, true) ||
+                        !db->setValue(_key, XObject((char*)&newPtr, sizeof(newPtr)), true)) {
+                    //Keep the file, the key still points to it
+                    ok = false;
+                } else {
+                    liveBytes += recordSize;
+                    __sync_fetch_and_add(&m_gcRewrittenBytes, record.valueLen);
+                }
+            }
+        }
+        unlockKey(_key);
+    }
+    fclose(fp);
+
+    if (ok && !rewrite) {
+        unsigned long long fileSize = offset;
+#ifndef WIN32
+        struct stat st;
+        if (::stat(fname.c_str(), &st) == 0) {
+            fileSize = st.st_size;
+        }
+#endif
+        *garbageRatio = (fileSize == 0) ? 100 : (int)((fileSize - liveBytes) * 100 / fileSize);
+    }
+    return ok;
+}
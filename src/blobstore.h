@@ -0,0 +1,150 @@
+﻿/*
+* Licensed to the Apache Software Foundation (ASF) under one
+* or more contributor license agreements.  See the NOTICE file
+* distributed with this work for additional information
+* regarding copyright ownership.  The ASF licenses this file
+* to you under the Apache License, Version 2.0 (the
+* "License"); you may not use this file except in compliance
+* with the License.  You may obtain a copy of the License at
+*
+*   http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing,
+* software distributed under the License is distributed on an
+* "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+* KIND, either express or implied.  See the License for the
+* specific language governing permissions and limitations
+* under the License.
+*/
+
+#ifndef BLOBSTORE_H
+#define BLOBSTORE_H
+
+#include <string>
+#include <map>
+#include <vector>
+
+#include "util/locker.h"
+#include "leveldb.h"
+
+/*
+    Key-value separation for large string values (WiscKey style)
+
+    Values above minBlobSize are appended to blob files under
+    <work_dir>/blob and leveldb only keeps a small BlobPointer, so the
+    compactions no longer rewrite the value bytes. The GC thread scans
+    the sealed blob files, rewrites the live records to the active file
+    and deletes the old file once enough of it is garbage.
+*/
+struct BlobPointer {
+    enum { _magic = 0x0b10b5e9 };
+    int magic;
+    unsigned int fileNo;
+    unsigned long long offset;      //offset of the value bytes
+    unsigned int size;              //value size
+    unsigned int valueChecksum;
+    unsigned int checksum;          //checksum of the fields above
+
+    bool isSameLocation(const BlobPointer& rhs) const
+    { return fileNo == rhs.fileNo && offset == rhs.offset; }
+};
+
+class BlobFile;
+class BlobGCThread;
+class BlobStore
+{
+public:
+    struct Option {
+        bool enabled;
+        size_t minBlobSize;
+        size_t maxFileSize;
+        int gcRatio;                //percent of garbage to rewrite a file
+        int gcInterval;             //sec
+        bool sync;
+
+        Option(void) {
+            enabled = false;
+            minBlobSize = 64 * 1024;
+            maxFileSize = 256 * 1024 * 1024;
+            gcRatio = 50;
+            gcInterval = 60;
+            sync = false;
+        }
+    };
+
+    BlobStore(LeveldbCluster* dbCluster);
+    ~BlobStore(void);
+
+    void setOption(const Option& opt) { m_option = opt; }
+    const Option& option(void) const { return m_option; }
+    bool isEnabled(void) const { return m_option.enabled; }
+
+    //Open the blob directory, old blob files are always readable
+    bool open(const std::string& dir);
+    void close(void);
+    void start(void);
+    void stop(void);
+
+    //Only string values and string chunks are separated
+    static bool isBlobKey(const XObject& key);
+    bool shouldSeparate(const XObject& key, const XObject& val) const;
+
+    static bool isPointer(const char* data, int len);
+    static bool isPointer(const std::string& val)
+    { return isPointer(val.data(), val.size()); }
+
+    //The pointer is durable only after the blob, the GC forces sync
+    bool put(const XObject& key, const XObject& mappingKey, const XObject& val,
+             BlobPointer* ptr, bool sync = false);
+    bool read(const BlobPointer& ptr, std::string& val);
+    //Replace a pointer in val with the value it points to
+    bool resolve(std::string& val);
+
+    //Serialize SET/DEL of a separated key with the GC rewriting it
+    void lockKey(const XObject& key);
+    void unlockKey(const XObject& key);
+
+    int fileCount(void);
+    unsigned long long totalSize(void);
+    unsigned long long gcRuns(void) const { return m_gcRuns; }
+    unsigned long long gcRewrittenBytes(void) const { return m_gcRewrittenBytes; }
+    unsigned long long gcRemovedFiles(void) const { return m_gcRemovedFiles; }
+
+private:
+    enum { KeyLockSize = 128 };
+    std::string blobFileName(unsigned int fileNo) const;
+    bool openActiveFile(unsigned int fileNo);
+    BlobFile* acquireFile(unsigned int fileNo);
+    void releaseFile(BlobFile* file);
+    void removeFile(unsigned int fileNo);
+    void collect(void);
+    bool collectFile(unsigned int fileNo, bool rewrite, int* garbageRatio);
+
+private:
+    LeveldbCluster* m_dbCluster;
+    BlobGCThread* m_gcThread;
+    Option m_option;
+    std::string m_dir;
+    bool m_opened;
+
+    Mutex m_writeLock;
+    int m_activeFd;
+    unsigned int m_activeFileNo;
+    unsigned long long m_activeSize;
+
+    Mutex m_filesLock;
+    std::map<unsigned int, BlobFile*> m_files;
+    unsigned int m_lastCollected;
+
+    Mutex m_keyLock[KeyLockSize];
+
+    unsigned long long m_gcRuns;
+    unsigned long long m_gcRewrittenBytes;
+    unsigned long long m_gcRemovedFiles;
+
+    friend class BlobGCThread;
+    BlobStore(const BlobStore&);
+    BlobStore& operator=(const BlobStore&);
+};
+
+#endif
@@ -1,4 +1,4 @@
-/*
+﻿/*
 * Licensed to the Apache Software Foundation (ASF) under one
 * or more contributor license agreements.  See the NOTICE file
 * distributed with this work for additional information
@@ -22,9 +22,11 @@
 #include "leveldb.h"
 #include "t_redis.h"
 #include "t_hyperloglog.h"
+#include "t_string.h"
 #include "dbcopy.h"
 #include "ttlmanager.h"
 #include "sync.h"
+#include "replication.h"
 #include "cmdhandler.h"
 
 class StringMutex
@@ -93,16 +95,10 @@ void onAppendCommand(ClientPacket* packet, void *)
     XObject appendValue(r.tokens[2].s, r.tokens[2].len);
 
     string_mutex.lock(key);
-    std::string val;
-    if (!db->value(key, val)) {
-        db->setValue(key, appendValue);
-        packet->sendBuff.appendFormatString(":%d\r\n", appendValue.len);
-    } else {
-        val.append(appendValue.data, appendValue.len);
-        db->setValue(key, XObject(val.data(), val.size()));
-        packet->sendBuff.appendFormatString(":%d\r\n", val.length());
-    }
+    TString str(db, key);
+    long long length = str.append(appendValue);
     string_mutex.unlock(key);
+    packet->sendBuff.appendFormatString(":%lld\r\n", length);
 
     packet->setFinishedState(ClientPacket::RequestFinished);
 }
@@ -236,12 +232,12 @@ void onGetRangeCommand(ClientPacket* packet, void *)
     LeveldbCluster* db = packet->proxy()->leveldbCluster();
     XObject key = makeStringKey(r.tokens[1].s, r.tokens[1].len, store);
 
-    std::string val;
-    db->value(key, val);
+    TString str(db, key);
+    int length = (int)str.length();
 
     int start = atoi(str_start.c_str());
     int stop = atoi(str_stop.c_str());
-    if (!transformStringIndex(start, stop, val.length())) {
+    if (!transformStringIndex(start, stop, length)) {
         packet->sendBuff.append("$0\r\n\r\n");
         packet->setFinishedState(ClientPacket::RequestFinished);
         return;
@@ -253,9 +249,10 @@ void onGetRangeCommand(ClientPacket* packet, void *)
         return;
     }
 
-    int len = (stop - start) + 1;
-    packet->sendBuff.appendFormatString("$%d\r\n", len);
-    packet->sendBuff.append(val.data() + start, len);
+    std::string val;
+    str.getRange(start, stop, val);
+    packet->sendBuff.appendFormatString("$%d\r\n", val.size());
+    packet->sendBuff.append(val.data(), val.size());
     packet->sendBuff.append("\r\n", 2);
     packet->setFinishedState(ClientPacket::RequestFinished);
 }
@@ -275,13 +272,15 @@ void onGetSetCommand(ClientPacket* packet, void *)
     XObject newValue(r.tokens[2].s, r.tokens[2].len);
 
     string_mutex.lock(key);
-    std::string oldValue;
-    if (!db->value(key, oldValue)) {
+    TString str(db, key);
+    if (!str.exists()) {
         packet->sendBuff.append("$-1\r\n");
     } else {
-        packet->sendBuff.appendFormatString("$%d\r\n%s\r\n", oldValue.length(), oldValue.c_str());
+        packet->sendBuff.appendFormatString("$%lld\r\n", str.length());
+        str.get(&packet->sendBuff);
+        packet->sendBuff.append("\r\n", 2);
     }
-    db->setValue(key, newValue);
+    str.set(newValue);
     string_mutex.unlock(key);
     packet->setFinishedState(ClientPacket::RequestFinished);
 }
@@ -419,10 +418,12 @@ void onMGetCommand(ClientPacket* packet, void *)
     LeveldbCluster* db = packet->proxy()->leveldbCluster();
     for (int i = 1; i < r.tokenCount; ++i) {
         std::string store;
-        std::string value;
         XObject key = makeStringKey(r.tokens[i].s, r.tokens[i].len, store);
-        if (db->value(key, value)) {
-            packet->sendBuff.appendFormatString("$%d\r\n%s\r\n", value.length(), value.c_str());
+        TString str(db, key);
+        if (str.exists()) {
+            packet->sendBuff.appendFormatString("$%lld\r\n", str.length());
+            str.get(&packet->sendBuff);
+            packet->sendBuff.append("\r\n", 2);
         } else {
             packet->sendBuff.append("$-1\r\n");
         }
@@ -443,7 +444,9 @@ void onMSetCommand(ClientPacket* packet, void *)
         std::string store;
         XObject key = makeStringKey(r.tokens[i].s, r.tokens[i].len, store);
         XObject value(r.tokens[i+1].s, r.tokens[i+1].len);
-        db->setValue(key, value);
+        string_mutex.lock(key);
+        TString(db, key).set(value);
+        string_mutex.unlock(key);
     }
     packet->sendBuff.append("+OK\r\n");
     packet->setFinishedState(ClientPacket::RequestFinished);
@@ -493,7 +496,9 @@ void onMSetNXCommand(ClientPacket* packet, void *)
         std::string store;
         XObject key = makeStringKey(r.tokens[i].s, r.tokens[i].len, store);
         XObject value(r.tokens[i+1].s, r.tokens[i+1].len);
-        db->setValue(key, value);
+        string_mutex.lock(key);
+        TString(db, key).set(value);
+        string_mutex.unlock(key);
     }
     packet->sendBuff.append(":1\r\n");
     packet->setFinishedState(ClientPacket::RequestFinished);
@@ -524,7 +529,7 @@ void onSetNXCommand(ClientPacket* packet, void *)
         return;
     }
     XObject value(r.tokens[2].s, r.tokens[2].len);
-    if (db->setValue(key, value)) {
+    if (TString(db, key).set(value)) {
         packet->sendBuff.append("+OK\r\n");
     } else {
         packet->sendBuff.append("-ERR Unknown error\r\n");
@@ -559,7 +564,7 @@ void onSetEXCommand(ClientPacket *packet, void *)
 
     string_mutex.lock(key);
     XObject value(r.tokens[3].s, r.tokens[3].len);
-    if (db->setValue(key, value)) {
+    if (TString(db, key).set(value)) {
         db->ttlManager()->setExpire(key, expire);
         packet->sendBuff.append("+OK\r\n");
     } else {
@@ -593,25 +598,10 @@ void onSetRangeCommand(ClientPacket* packet, void *)
     XObject key = makeStringKey(r.tokens[1].s, r.tokens[1].len, store);
     string_mutex.lock(key);
     LeveldbCluster* db = packet->proxy()->leveldbCluster();
-    std::string val;
-    std::string replace(r.tokens[3].s, r.tokens[3].len);
-    if (db->value(key, val)) {
-        if ((unsigned int)offset_ > val.length()) {
-            int t = offset_ - val.length();
-            val.append(t, '\x00');
-            val.append(replace.data(), replace.size());
-        }else if ((unsigned int)offset_ == val.length()) {
-            val.append(replace.data(), replace.size());
-        } else if ((unsigned int)offset_ < val.length()) {
-            val.replace(offset_, replace.length(), replace.data());
-        }
-    } else {
-        val.assign(offset_ + 1, '\x00');
-        val += replace;
-    }
-    db->setValue(key, XObject(val.data(), val.size()));
+    XObject replace(r.tokens[3].s, r.tokens[3].len);
+    long long length = TString(db, key).setRange(offset_, replace);
     string_mutex.unlock(key);
-    packet->sendBuff.appendFormatString(":%d\r\n", val.length());
+    packet->sendBuff.appendFormatString(":%lld\r\n", length);
     packet->setFinishedState(ClientPacket::RequestFinished);
 }
 
@@ -628,9 +618,7 @@ void onStrlenCommand(ClientPacket* packet, void *)
     LeveldbCluster* db = packet->proxy()->leveldbCluster();
     XObject key = makeStringKey(r.tokens[1].s, r.tokens[1].len, store);
 
-    std::string value;
-    db->value(key, value);
-    packet->sendBuff.appendFormatString(":%d\r\n", value.length());
+    packet->sendBuff.appendFormatString(":%lld\r\n", TString(db, key).length());
     packet->setFinishedState(ClientPacket::RequestFinished);
 }
 
@@ -642,13 +630,14 @@ void onGetCommand(ClientPacket* packet, void*)
         return;
     }
 
-    std::string val;
     std::string store;
     XObject key = makeStringKey(r.tokens[1].s, r.tokens[1].len, store);
     LeveldbCluster* db = packet->proxy()->leveldbCluster();
-    if (db->value(key, val)) {
-        packet->sendBuff.appendFormatString("$%d\r\n", val.size());
-        packet->sendBuff.append(val.data(), val.size());
+    TString str(db, key);
+    if (str.exists()) {
+        //Chunked values are copied to the reply chunk by chunk
+        packet->sendBuff.appendFormatString("$%lld\r\n", str.length());
+        str.get(&packet->sendBuff);
         packet->sendBuff.append("\r\n");
     } else {
         packet->sendBuff.append("$-1\r\n");
@@ -695,7 +684,8 @@ void onSetCommand(ClientPacket* packet, void*)
     XObject value(r.tokens[2].s, r.tokens[2].len);
 
     LeveldbCluster* db = packet->proxy()->leveldbCluster();
-    if (db->setValue(key, value)) {
+    string_mutex.lock(key);
+    if (TString(db, key).set(value)) {
         if (expire != -1) {
             db->ttlManager()->setExpire(key, expire);
         }
@@ -703,6 +693,7 @@ void onSetCommand(ClientPacket* packet, void*)
     } else {
         packet->sendBuff.append("-ERR Unknown error\r\n");
     }
+    string_mutex.unlock(key);
 
     packet->setFinishedState(ClientPacket::RequestFinished);
 }
@@ -719,12 +710,12 @@ void onDelCommand(ClientPacket* packet, void*)
     LeveldbCluster* db = packet->proxy()->leveldbCluster();
     for (int i = 1; i < r.tokenCount; ++i) {
         std::string store;
-        std::string value;
         XObject key = makeStringKey(r.tokens[i].s, r.tokens[i].len, store);
-        if (db->value(key, value)) {
-            db->remove(key);
+        string_mutex.lock(key);
+        if (TString(db, key).remove()) {
             ++succeed;
         }
+        string_mutex.unlock(key);
     }
     packet->sendBuff.appendFormatString(":%d\r\n", succeed);
     packet->setFinishedState(ClientPacket::RequestFinished);
@@ -1003,10 +994,29 @@ void onSyncCommand(ClientPacket* packet, void* arg)
                 int pos = -1;
                 bool isBreak = false;
                 BinlogBufferReader reader = parser.reader();
+
+                //Seek to the indexed record closest to the resume point
+                BinlogIndex binlogIndex;
+                if (firstPos >= 0 && db->binlogIndex(s, &binlogIndex)) {
+                    int first = 0;
+                    long long offset = binlogIndex.findRecord(firstPos + 1, &first);
+                    if (offset <= parser.size()) {
+                        reader = parser.reader(offset);
+                        pos = first - 1;
+                    }
+                }
+
+                //The __SYNC stream keeps the record layout of the format v1
                 Binlog::LogItem* item = reader.firstItem();
                 for (; item != NULL; item = reader.nextItem(item)) {
                     if (pos >= firstPos) {
-                        reply.append((char*)item, item->item_size);
+                        Binlog::LegacyLogItem legacyItem;
+                        legacyItem.item_size = sizeof(legacyItem) + item->key_size + item->value_size;
+                        legacyItem.type = item->type;
+                        legacyItem.key_size = item->key_size;
+                        legacyItem.value_size = item->value_size;
+                        reply.append((char*)&legacyItem, sizeof(legacyItem));
+                        reply.append(item->keyBuffer(), item->key_size + item->value_size);
                         ++count;
                     }
                     ++pos;
@@ -1037,6 +1047,35 @@ void onSyncCommand(ClientPacket* packet, void* arg)
     packet->setFinishedState(ClientPacket::RequestFinished);
 }
 
+void onReplStreamCommand(ClientPacket* packet, void* arg)
+{
+    RedisProtoParseResult& r = packet->recvParseResult;
+    if (r.tokenCount != 3 && r.tokenCount != 4) {
+        packet->setFinishedState(ClientPacket::WrongNumberOfArguments);
+        return;
+    }
+
+    //__replstream [filename] [offset] or __replstream [filename] [last update pos] RECORD
+    bool isRecordIndex = false;
+    if (r.tokenCount == 4) {
+        if (r.tokens[3].len != 6 || strncasecmp(r.tokens[3].s, "RECORD", 6) != 0) {
+            packet->setFinishedState(ClientPacket::RequestError);
+            return;
+        }
+        isRecordIndex = true;
+    }
+
+    std::string fileName(r.tokens[1].s, r.tokens[1].len);
+    std::string _position(r.tokens[2].s, r.tokens[2].len);
+    long long position = atoll(_position.c_str());
+
+    //The connection is handed over to a replication sender, nothing is replied here
+    RedisProxy* proxy = (RedisProxy*)arg;
+    ReplicationMaster* replication = proxy->leveldbCluster()->replication();
+    replication->addReplica(packet->clientSocket, packet->clientAddress, fileName, position, isRecordIndex);
+    proxy->closeConnection(packet);
+}
+
 void onCopyCommand(ClientPacket *packet, void *)
 {
     RedisProtoParseResult& r = packet->recvParseResult;
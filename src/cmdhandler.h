@@ -55,6 +55,7 @@ void onPingCommand(ClientPacket*, void*);
 
 void onShowCommand(ClientPacket*, void*);
 void onSyncCommand(ClientPacket*, void*);       //__sync [filename] [last update pos]
+void onReplStreamCommand(ClientPacket*, void*); //__replstream [filename] [offset] [RECORD]
 void onCopyCommand(ClientPacket*, void*);       //__copy [local onevalue port]
 void onSyncFromCommand(ClientPacket*, void*);   //syncfrom [dest ip] [dest port]
 
@@ -128,6 +128,25 @@ const char *RedisCommand::commandName(int type)
     return "";
 }
 
+bool RedisCommand::isWriteCommand(int type)
+{
+    switch (type) {
+    case APPEND: case DECR: case DECRBY: case GETSET: case INCR: case INCRBY:
+    case INCRBYFLOAT: case MSET: case MSETNX: case PSETEX: case SETEX: case SETNX:
+    case SETRANGE: case SET: case DEL: case EXPIRE:
+    case ZADD: case ZREM: case ZINCRBY: case ZREMRANGEBYRANK: case ZREMRANGEBYSCORE: case ZCLEAR:
+    case SADD: case SDIFFSTORE: case SINTERSTORE: case SMOVE: case SPOP: case SREM:
+    case SUNIONSTORE: case SCLEAR:
+    case HSET: case HINCRBY: case HINCRBYFLOAT: case HDEL: case HMSET: case HSETNX: case HCLEAR:
+    case LINSERT: case LPOP: case LPUSH: case LPUSHX: case LREM: case LSET: case LTRIM:
+    case RPOP: case RPUSH: case RPUSHX: case RPOPLPUSH: case LCLEAR:
+    case PFADD: case PFMERGE:
+        return true;
+    default:
+        return false;
+    }
+}
+
 
 
 RedisCommandTable::RedisCommandTable(void)
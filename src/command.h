@@ -55,6 +55,7 @@ public:
 
 public:
     static const char* commandName(int type);
+    static bool isWriteCommand(int type);
 
 public:
     char name[32];
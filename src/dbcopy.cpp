@@ -22,7 +22,9 @@
 #include "util/logger.h"
 #include "t_zset.h"
 #include "t_hash.h"
+#include "t_string.h"
 #include "ttlmanager.h"
+#include "blobstore.h"
 
 #include "dbcopy.h"
 
@@ -63,6 +65,23 @@ bool DBCopy::start(LeveldbCluster* src, const HostAddress& dest)
             XObject key = iter.key();
             XObject value = iter.value();
 
+            //Send the value instead of a pointer to the local blob file
+            std::string blobValue;
+            if (BlobStore::isPointer(value.data, value.len)) {
+                LeveldbCluster::ReadOption opt;
+                std::string mapping;
+                if (*((short*)key.data) == T_StringChunk) {
+                    TString::chunkMappingKey(key.data, key.len, mapping);
+                    opt.mapping_key = XObject(mapping.data(), mapping.size());
+                }
+                if (!src->value(key, blobValue, opt)) {
+                    Logger::log(Logger::Warning, "DBCopy: can't read the blob value, key skipped");
+                    iter.next();
+                    continue;
+                }
+                value = XObject(blobValue.data(), blobValue.size());
+            }
+
             if ((records % m_maxPipeline) == 0) {
                 if (!sendbuff.isEmpty()) {
                     int sendBytes = socket.send(sendbuff.data(), sendbuff.size());
@@ -123,6 +142,21 @@ void DBCopy::makeCommand(IOBuffer* buff, const XObject &key, const XObject &valu
         buff->append("\r\n", 2);
     }
         break;
+    case T_StringChunk: {
+        std::string mapping;
+        TString::chunkMappingKey(key.data, key.len, mapping);
+        buff->append("*4\r\n$6\r\nRAWSET\r\n", 16);
+        buff->appendFormatString("$%d\r\n", key.len);
+        buff->append(key.data, key.len);
+        buff->append("\r\n", 2);
+        buff->appendFormatString("$%d\r\n", value.len);
+        buff->append(value.data, value.len);
+        buff->append("\r\n", 2);
+        buff->appendFormatString("$%d\r\n", mapping.size());
+        buff->append(mapping.data(), mapping.size());
+        buff->append("\r\n", 2);
+    }
+        break;
     default:
         break;
     }
@@ -22,6 +22,12 @@
 #include "leveldb.h"
 #include "util/logger.h"
 #include "ttlmanager.h"
+#include "writethrottle.h"
+#include "blobstore.h"
+#include "objectcache.h"
+#include "singleflight.h"
+#include "replication.h"
+#include "binlogwriter.h"
 
 struct KeyHeader {
     int timestamp;
@@ -202,6 +208,17 @@ bool Leveldb::remove(const XObject& key, bool sync)
 #endif
 }
 
+bool Leveldb::property(const std::string& name, std::string& value)
+{
+#ifndef WIN32
+    return m_db->GetProperty(leveldb::Slice(name), &value);
+#else
+    (void)name;
+    (void)value;
+    return false;
+#endif
+}
+
 void Leveldb::clear(void)
 {
     LeveldbIterator it;
@@ -241,18 +258,31 @@ static bool createDirectory(const std::string& dir)
 }
 
 
-LeveldbCluster::LeveldbCluster(void)
+LeveldbCluster::LeveldbCluster(void) :
+    m_binlogAppended(&m_binlogMutex)
 {
     for (int i = 0; i < MaxHashValue; ++i) {
         m_hashMapping[i] = NULL;
     }
     m_started = false;
     m_ttlManager = new TTLManager(this);
+    m_writeThrottle = new WriteThrottle(this);
+    m_blobStore = new BlobStore(this);
+    m_objectCache = new ObjectCache;
+    m_singleFlight = new SingleFlight;
+    m_replication = new ReplicationMaster(this);
+    m_binlogWriter = new BinlogWriter(this);
 }
 
 LeveldbCluster::~LeveldbCluster(void)
 {
     stop();
+    delete m_binlogWriter;
+    delete m_replication;
+    delete m_singleFlight;
+    delete m_objectCache;
+    delete m_blobStore;
+    delete m_writeThrottle;
     delete m_ttlManager;
 }
 
@@ -330,13 +360,28 @@ bool LeveldbCluster::start(const LeveldbCluster::Option& opt)
 
     m_option = opt;
     m_option.workdir = workdir;
+
+    if (!m_blobStore->open(subFileName("blob"))) {
+        Logger::log(Logger::Error, "Open blob store failed");
+        stop();
+        return false;
+    }
+
     m_started = true;
 
     if (m_option.binlogEnabled) {
-        initBinlog();
+        if (!initBinlog()) {
+            Logger::log(Logger::Error, "Init binlog failed");
+            stop();
+            return false;
+        }
+        m_binlogWriter->start();
     }
 
     m_ttlManager->start();
+    m_writeThrottle->start();
+    m_blobStore->start();
+    m_replication->start();
 
     Logger::log(Logger::Message, "Database started. workdir=%s maxhash=%d sync=%s "
                     "binlog_enabled=%s max_binlog_size=%dMB",
@@ -357,12 +402,17 @@ void LeveldbCluster::stop(void)
         }
 
         /* stop the ttl manager before the database shutdown, else it may coredumped */
+        m_replication->stop();
         m_ttlManager->stop();
+        m_writeThrottle->stop();
+        m_blobStore->stop();
+        m_binlogWriter->stop();
         
         for (unsigned int i = 0; i < m_dbs.size(); ++i) {
             Leveldb* db = m_dbs[i];
             delete db;
         }
+        m_blobStore->close();
 
         m_curBinlog.close();
         m_started = false;
@@ -396,12 +446,42 @@ bool LeveldbCluster::setValue(const XObject& key, const XObject& val, const Writ
     if (!db) {
         return false;
     }
-    bool ok = db->setValue(key, val, m_option.sync);
+
+    bool ok;
+    if (m_blobStore->isEnabled() && BlobStore::isBlobKey(key)) {
+        //Large values go to the blob files, leveldb keeps the pointer only
+        m_blobStore->lockKey(key);
+        if (m_blobStore->shouldSeparate(key, val)) {
+            BlobPointer ptr;
+            ok = m_blobStore->put(key, opt.mapping_key, val, &ptr);
+            if (ok) {
+                ok = db->setValue(key, XObject((char*)&ptr, sizeof(ptr)), m_option.sync);
+            }
+        } else {
+            ok = db->setValue(key, val, m_option.sync);
+        }
+        m_blobStore->unlockKey(key);
+    } else {
+        ok = db->setValue(key, val, m_option.sync);
+    }
+    if (m_objectCache->isEnabled()) {
+        m_objectCache->invalidate(key);
+    }
+    if (m_option.readCoalescing) {
+        m_singleFlight->forget(key);
+    }
+
+    //The binlog always carries the value itself
     if (ok && m_option.binlogEnabled) {
-        lockCurrentBinlogFile();
-        m_curBinlog.appendSetRecord(key.data, key.len, val.data, val.len);
-        ajustCurrentBinlogFile();
-        unlockCurrentBinlogFile();
+        if (m_binlogWriter->isRunning()) {
+            m_binlogWriter->appendSetRecord(key.data, key.len, val.data, val.len);
+        } else {
+            lockCurrentBinlogFile();
+            m_curBinlog.appendSetRecord(key.data, key.len, val.data, val.len);
+            ajustCurrentBinlogFile();
+            m_binlogAppended.broadcast();
+            unlockCurrentBinlogFile();
+        }
     }
     return ok;
 }
@@ -413,7 +493,53 @@ bool LeveldbCluster::value(const XObject& key, std::string &val, const ReadOptio
     if (!db) {
         return false;
     }
-    return db->value(key, val);
+    if (!m_objectCache->isEnabled()) {
+        return coalescedReadValue(db, key, val);
+    }
+
+    if (m_objectCache->lookup(key, val)) {
+        return true;
+    }
+    unsigned long long generation = m_objectCache->generation(key);
+    if (!coalescedReadValue(db, key, val)) {
+        return false;
+    }
+    m_objectCache->insert(key, val, generation);
+    return true;
+}
+
+bool LeveldbCluster::coalescedReadValue(Leveldb* db, const XObject& key, std::string& val)
+{
+    if (!m_option.readCoalescing) {
+        return readValue(db, key, val);
+    }
+
+    SingleFlight::Call* call;
+    if (!m_singleFlight->begin(key, &call)) {
+        return m_singleFlight->wait(key, call, val);
+    }
+    bool found = readValue(db, key, val);
+    m_singleFlight->finish(key, call, found, val);
+    return found;
+}
+
+bool LeveldbCluster::readValue(Leveldb* db, const XObject& key, std::string& val)
+{
+    if (!db->value(key, val)) {
+        return false;
+    }
+    if (!BlobStore::isPointer(val)) {
+        return true;
+    }
+    if (m_blobStore->resolve(val)) {
+        return true;
+    }
+
+    //The blob file may have been collected after the pointer was read
+    if (!db->value(key, val)) {
+        return false;
+    }
+    return m_blobStore->resolve(val);
 }
 
 bool LeveldbCluster::remove(const XObject& key, const WriteOption& opt)
@@ -423,12 +549,30 @@ bool LeveldbCluster::remove(const XObject& key, const WriteOption& opt)
     if (!db) {
         return false;
     }
-    bool ok = db->remove(key, m_option.sync);
+    bool ok;
+    if (m_blobStore->isEnabled() && BlobStore::isBlobKey(key)) {
+        m_blobStore->lockKey(key);
+        ok = db->remove(key, m_option.sync);
+        m_blobStore->unlockKey(key);
+    } else {
+        ok = db->remove(key, m_option.sync);
+    }
+    if (m_objectCache->isEnabled()) {
+        m_objectCache->invalidate(key);
+    }
+    if (m_option.readCoalescing) {
+        m_singleFlight->forget(key);
+    }
     if (ok && m_option.binlogEnabled) {
-        lockCurrentBinlogFile();
-        m_curBinlog.appendDelRecord(key.data, key.len);
-        ajustCurrentBinlogFile();
-        unlockCurrentBinlogFile();
+        if (m_binlogWriter->isRunning()) {
+            m_binlogWriter->appendDelRecord(key.data, key.len);
+        } else {
+            lockCurrentBinlogFile();
+            m_curBinlog.appendDelRecord(key.data, key.len);
+            ajustCurrentBinlogFile();
+            m_binlogAppended.broadcast();
+            unlockCurrentBinlogFile();
+        }
     }
     return ok;
 }
@@ -438,6 +582,46 @@ void LeveldbCluster::clear(void)
     for (int i = 0; i < databaseCount(); ++i) {
         database(i)->clear();
     }
+    m_objectCache->clear();
+}
+
+void LeveldbCluster::notifyBinlogWaiters(void)
+{
+    lockCurrentBinlogFile();
+    m_binlogAppended.broadcast();
+    unlockCurrentBinlogFile();
+}
+
+bool LeveldbCluster::binlogIndex(const std::string& baseName, BinlogIndex* index)
+{
+    std::string fullPath = binlogFileName(baseName);
+    lockCurrentBinlogFile();
+    if (m_curBinlog.fileName() == fullPath) {
+        *index = *m_curBinlog.index();
+        unlockCurrentBinlogFile();
+        return true;
+    }
+    unlockCurrentBinlogFile();
+    return BinlogIndex::loadFromFile(index, fullPath);
+}
+
+void LeveldbCluster::appendBinlogBatch(char* buff, int size, bool sync)
+{
+    lockCurrentBinlogFile();
+    m_curBinlog.appendRecords(buff, size);
+    if (sync) {
+        m_curBinlog.syncToDisk();
+    }
+    ajustCurrentBinlogFile();
+    m_binlogAppended.broadcast();
+    unlockCurrentBinlogFile();
+}
+
+void LeveldbCluster::syncBinlog(void)
+{
+    lockCurrentBinlogFile();
+    m_curBinlog.syncToDisk();
+    unlockCurrentBinlogFile();
 }
 
 bool LeveldbCluster::initBinlog(void)
@@ -463,12 +647,32 @@ bool LeveldbCluster::initBinlog(void)
         lastBinlogFile = binlogFileName(m_binlogFileList.fileName(fileCount-1));
     }
 
+    for (int i = 0; i < fileCount; ++i) {
+        std::string fname = binlogFileName(m_binlogFileList.fileName(i));
+        if (Binlog::isV1File(fname)) {
+            Logger::log(Logger::Error, "initBinlog: '%s' is binlog format v1, stop the server and "
+                        "convert the binlog directory with onevalue-binlog-convert", fname.c_str());
+            return false;
+        }
+    }
+
     Logger::log(Logger::Message, "Open binlog file '%s'...", lastBinlogFile.c_str());
     if (!m_curBinlog.open(lastBinlogFile)) {
         Logger::log(Logger::Error, "Can't open binlog file '%s'", lastBinlogFile.c_str());
         return false;
     }
 
+    //The last file may be empty after a rotation
+    if (m_curBinlog.index()->recordCount() == 0 && fileCount >= 2) {
+        BinlogIndex prevIndex;
+        if (BinlogIndex::loadFromFile(&prevIndex, binlogFileName(m_binlogFileList.fileName(fileCount-2)))) {
+            m_curBinlog.resumeSeq(prevIndex.lastSeq());
+        }
+    }
+    Logger::log(Logger::Message, "Binlog '%s' opened: size=%lld records=%d last_seq=%lld",
+                lastBinlogFile.c_str(), (long long)m_curBinlog.writtenSize(),
+                m_curBinlog.index()->recordCount(), m_curBinlog.lastSeq());
+
     if (!randomFileName.empty()) {
         m_binlogFileList.appendFileName(randomFileName);
         BinlogFileList::saveToFile(&m_binlogFileList, indexFile);
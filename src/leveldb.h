@@ -38,6 +38,12 @@ class Leveldb;
 class LeveldbIterator;
 class LeveldbCluster;
 class TTLManager;
+class WriteThrottle;
+class BlobStore;
+class ObjectCache;
+class SingleFlight;
+class ReplicationMaster;
+class BinlogWriter;
 
 class XObject
 {
@@ -185,6 +191,8 @@ public:
     bool remove(const XObject& key, bool sync = false);
     void clear(void);
 
+    bool property(const std::string& name, std::string& value);
+
 private:
 #ifndef WIN32
     leveldb::DB* m_db;
@@ -209,6 +217,7 @@ public:
         HashFunc hashfunc;
         Leveldb::Option leveldbopt;
         bool sync;
+        bool readCoalescing;
         bool binlogEnabled;
         size_t maxBinlogSize;
         size_t blockSize;
@@ -219,6 +228,7 @@ public:
             maxhash = 128;
             hashfunc = hashForBytes;
             sync = false;
+            readCoalescing = false;
             binlogEnabled = false;
             maxBinlogSize = 64*1024*1024;
             blockSize = 16 * 1024;
@@ -233,6 +243,7 @@ public:
                 hashfunc = opt.hashfunc;
                 leveldbopt = opt.leveldbopt;
                 sync = opt.sync;
+                readCoalescing = opt.readCoalescing;
                 binlogEnabled = opt.binlogEnabled;
                 maxBinlogSize = opt.maxBinlogSize;
                 blockSize = opt.blockSize;
@@ -271,6 +282,13 @@ public:
     BinlogFileList* binlogFileList(void) { return &m_binlogFileList; }
     Binlog* currentBinlog(void) { return &m_curBinlog; }
     TTLManager* ttlManager(void) { return m_ttlManager; }
+    WriteThrottle* writeThrottle(void) { return m_writeThrottle; }
+    BlobStore* blobStore(void) { return m_blobStore; }
+    ObjectCache* objectCache(void) { return m_objectCache; }
+    SingleFlight* singleFlight(void) { return m_singleFlight; }
+    ReplicationMaster* replication(void) { return m_replication; }
+    BinlogWriter* binlogWriter(void) { return m_binlogWriter; }
+    bool isReadCoalescing(void) const { return m_option.readCoalescing; }
 
     std::string subFileName(const std::string& fileName) const;
     std::string binlogListFileName(void) const;
@@ -285,8 +303,18 @@ public:
 
     void lockCurrentBinlogFile(void) { m_binlogMutex.lock(); }
     void unlockCurrentBinlogFile(void) { m_binlogMutex.unlock(); }
+    //Wait for a binlog append, the binlog file must be locked by the caller
+    bool waitBinlogAppended(int msec) { return m_binlogAppended.wait(msec); }
+    void notifyBinlogWaiters(void);
+    //Sparse record index of a binlog file, the base name is an entry of the binlog file list
+    bool binlogIndex(const std::string& baseName, BinlogIndex* index);
+    //Used by the binlog writer thread
+    void appendBinlogBatch(char* buff, int size, bool sync);
+    void syncBinlog(void);
 
 private:
+    bool readValue(Leveldb* db, const XObject& key, std::string& val);
+    bool coalescedReadValue(Leveldb* db, const XObject& key, std::string& val);
     bool initBinlog(void);
     void ajustCurrentBinlogFile(void);
     std::string buildRandomBinlogFileBaseName(void) const;
@@ -298,8 +326,15 @@ private:
     bool m_started;
     BinlogFileList m_binlogFileList;
     Mutex m_binlogMutex;
+    Condition m_binlogAppended;
     Binlog m_curBinlog;
     TTLManager* m_ttlManager;
+    WriteThrottle* m_writeThrottle;
+    BlobStore* m_blobStore;
+    ObjectCache* m_objectCache;
+    SingleFlight* m_singleFlight;
+    ReplicationMaster* m_replication;
+    BinlogWriter* m_binlogWriter;
 
 private:
     LeveldbCluster(const LeveldbCluster&);
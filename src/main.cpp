@@ -25,6 +25,11 @@
 #include "onevaluecfg.h"
 #include "monitor.h"
 #include "sync.h"
+#include "writethrottle.h"
+#include "blobstore.h"
+#include "t_string.h"
+#include "objectcache.h"
+#include "binlogwriter.h"
 #include "non-portable.h"
 
 RedisProxy* currentProxy = NULL;
@@ -81,6 +86,7 @@ void startOneValue(void)
     clusterOption.workdir = cfg->workDir();
     clusterOption.maxhash = cfg->hashMax();
     clusterOption.sync = opt->sync();
+    clusterOption.readCoalescing = opt->readCoalescing();
     clusterOption.leveldbopt.compress = opt->compress();
     clusterOption.leveldbopt.cacheSize = opt->lruCacheSize();
     clusterOption.leveldbopt.writeBufferSize = opt->writeBufSize();
@@ -92,6 +98,47 @@ void startOneValue(void)
         clusterOption.dbnames.push_back(dbcfg->db_name);
     }
 
+    BinlogWriter::Option writerOption;
+    writerOption.enabled = binlogCfg->writerEnabled();
+    writerOption.syncMode = binlogCfg->syncMode();
+    writerOption.syncInterval = binlogCfg->syncInterval();
+    cluster.binlogWriter()->setOption(writerOption);
+
+    CWriteThrottle* throttleCfg = cfg->writeThrottle();
+    WriteThrottle::Option throttleOption;
+    throttleOption.enabled = throttleCfg->enabled();
+    throttleOption.slowdownLevel0Files = throttleCfg->slowdownL0Files();
+    throttleOption.stopLevel0Files = throttleCfg->stopL0Files();
+    throttleOption.slowdownPendingBytes = throttleCfg->slowdownPendingSize();
+    throttleOption.stopPendingBytes = throttleCfg->stopPendingSize();
+    throttleOption.maxDelay = throttleCfg->maxDelay();
+    cluster.writeThrottle()->setOption(throttleOption);
+
+    CBlob* blobCfg = cfg->blob();
+    BlobStore::Option blobOption;
+    blobOption.enabled = blobCfg->enabled();
+    blobOption.minBlobSize = blobCfg->minBlobSize();
+    blobOption.maxFileSize = blobCfg->maxFileSize();
+    blobOption.gcRatio = blobCfg->gcRatio();
+    blobOption.gcInterval = blobCfg->gcInterval();
+    blobOption.sync = clusterOption.sync;
+    cluster.blobStore()->setOption(blobOption);
+
+    CStringChunk* chunkCfg = cfg->stringChunk();
+    TString::Option stringOption;
+    stringOption.enabled = chunkCfg->enabled();
+    stringOption.threshold = chunkCfg->thresholdSize();
+    stringOption.chunkSize = chunkCfg->chunkSize();
+    TString::setOption(stringOption);
+
+    CCache* cacheCfg = cfg->cache();
+    ObjectCache::Option cacheOption;
+    cacheOption.enabled = cacheCfg->enabled();
+    cacheOption.capacity = cacheCfg->capacity();
+    cacheOption.maxValueSize = cacheCfg->maxValueSize();
+    cacheOption.shards = cacheCfg->shardCount();
+    cluster.objectCache()->setOption(cacheOption);
+
     //Start cluster and set mapping
     if (!cluster.start(clusterOption)) {
         Logger::log(Logger::Error, "Start failed. Stop");
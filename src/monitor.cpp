@@ -18,6 +18,13 @@
 */
 
 #include "monitor.h"
+#include "writethrottle.h"
+#include "blobstore.h"
+#include "objectcache.h"
+#include "singleflight.h"
+#include "replication.h"
+#include "binlogwriter.h"
+#include "sync.h"
 #include <string.h>
 
 #define STATUS          "STATUS"
@@ -417,9 +424,157 @@ void CFormatMonitorToIoBuf::formatClientsToIoBuf(CProxyMonitor& proxyMonirot) {
     }
 }
 
+void CFormatMonitorToIoBuf::formatWriteThrottleToIoBuf(CProxyMonitor& proxyMonirot) {
+    LeveldbCluster* cluster = proxyMonirot.redisProxy()->leveldbCluster();
+    if (!cluster) {
+        return;
+    }
+    WriteThrottle* throttle = cluster->writeThrottle();
+    m_iobuf->append("\n[WriteThrottle]\n");
+    m_iobuf->appendFormatString("Enabled=%s\n", throttle->isEnabled() ? "Yes" : "No");
+    if (!throttle->isEnabled()) {
+        return;
+    }
+    m_iobuf->appendFormatString("State=%s\n", WriteThrottle::stateName(throttle->state()));
+    m_iobuf->appendFormatString("WriteDelay=%dms\n", throttle->writeDelay());
+    m_iobuf->appendFormatString("DelayedWrites=%llu\n", throttle->delayedWrites());
+    m_iobuf->appendFormatString("RejectedWrites=%llu\n", throttle->rejectedWrites());
+
+    std::vector<WriteThrottle::ShardStatus> shards;
+    throttle->shardStatus(shards);
+    m_iobuf->append("[DB]                            [L0 FILES]  [PENDING COMPACTION]  [STATE]\n");
+    for (unsigned int i = 0; i < shards.size(); ++i) {
+        WriteThrottle::ShardStatus& shard = shards[i];
+        m_iobuf->appendFormatString("%-32s%10d%19.2fMB  %s\n",
+                                    shard.name.c_str(),
+                                    shard.level0Files,
+                                    shard.pendingCompactionBytes / (1024 * 1024.0),
+                                    WriteThrottle::stateName(shard.state));
+    }
+}
+
+void CFormatMonitorToIoBuf::formatBlobStoreToIoBuf(CProxyMonitor& proxyMonirot) {
+    LeveldbCluster* cluster = proxyMonirot.redisProxy()->leveldbCluster();
+    if (!cluster) {
+        return;
+    }
+    BlobStore* blob = cluster->blobStore();
+    m_iobuf->append("\n[BlobStore]\n");
+    m_iobuf->appendFormatString("Enabled=%s\n", blob->isEnabled() ? "Yes" : "No");
+    m_iobuf->appendFormatString("Files=%d\n", blob->fileCount());
+    m_iobuf->appendFormatString("TotalSize=%.2fMB\n", blob->totalSize() / (1024 * 1024.0));
+    m_iobuf->appendFormatString("GCRuns=%llu\n", blob->gcRuns());
+    m_iobuf->appendFormatString("GCRewritten=%.2fMB\n", blob->gcRewrittenBytes() / (1024 * 1024.0));
+    m_iobuf->appendFormatString("GCRemovedFiles=%llu\n", blob->gcRemovedFiles());
+}
+
+void CFormatMonitorToIoBuf::formatObjectCacheToIoBuf(CProxyMonitor& proxyMonirot) {
+    LeveldbCluster* cluster = proxyMonirot.redisProxy()->leveldbCluster();
+    if (!cluster) {
+        return;
+    }
+    ObjectCache* cache = cluster->objectCache();
+    m_iobuf->append("\n[ObjectCache]\n");
+    m_iobuf->appendFormatString("Enabled=%s\n", cache->isEnabled() ? "Yes" : "No");
+    if (!cache->isEnabled()) {
+        return;
+    }
+    ObjectCache::Stats stats;
+    cache->stats(&stats);
+    unsigned long long lookups = stats.hits + stats.misses;
+    m_iobuf->appendFormatString("Capacity=%.2fMB\n", cache->option().capacity / (1024 * 1024.0));
+    m_iobuf->appendFormatString("Used=%.2fMB\n", stats.bytes / (1024 * 1024.0));
+    m_iobuf->appendFormatString("Entries=%llu\n", stats.entries);
+    m_iobuf->appendFormatString("Hits=%llu\n", stats.hits);
+    m_iobuf->appendFormatString("Misses=%llu\n", stats.misses);
+    m_iobuf->appendFormatString("HitRate=%.2f%%\n", lookups ? stats.hits * 100.0 / lookups : 0.0);
+    m_iobuf->appendFormatString("Inserts=%llu\n", stats.inserts);
+    m_iobuf->appendFormatString("AdmissionRejects=%llu\n", stats.rejects);
+    m_iobuf->appendFormatString("Evictions=%llu\n", stats.evictions);
+    m_iobuf->appendFormatString("Invalidations=%llu\n", stats.invalidations);
+}
+
+void CFormatMonitorToIoBuf::formatReadCoalescingToIoBuf(CProxyMonitor& proxyMonirot) {
+    LeveldbCluster* cluster = proxyMonirot.redisProxy()->leveldbCluster();
+    if (!cluster) {
+        return;
+    }
+    m_iobuf->append("\n[ReadCoalescing]\n");
+    m_iobuf->appendFormatString("Enabled=%s\n", cluster->isReadCoalescing() ? "Yes" : "No");
+    if (!cluster->isReadCoalescing()) {
+        return;
+    }
+    m_iobuf->appendFormatString("StorageReads=%llu\n", cluster->singleFlight()->leaderReads());
+    m_iobuf->appendFormatString("CoalescedReads=%llu\n", cluster->singleFlight()->coalescedReads());
+}
+
+void CFormatMonitorToIoBuf::formatReplicationToIoBuf(CProxyMonitor& proxyMonirot) {
+    RedisProxy* proxy = proxyMonirot.redisProxy();
+    LeveldbCluster* cluster = proxy->leveldbCluster();
+    if (!cluster) {
+        return;
+    }
+    m_iobuf->append("\n[Replication]\n");
+
+    std::vector<ReplicationMaster::ReplicaInfo> replicas;
+    cluster->replication()->replicas(replicas);
+    m_iobuf->appendFormatString("Replicas=%d\n", (int)replicas.size());
+    for (unsigned int i = 0; i < replicas.size(); ++i) {
+        const ReplicationMaster::ReplicaInfo& info = replicas[i];
+        m_iobuf->appendFormatString("Replica%d=%s sent=%s:%lld acked=%s:%lld lag_bytes=%lld\n",
+                                    i, info.address.c_str(),
+                                    info.sentFileName.c_str(), info.sentPos,
+                                    info.ackedFileName.c_str(), info.ackedPos,
+                                    info.sentOffset - info.ackedOffset);
+    }
+
+    Sync* sync = proxy->syncThread();
+    if (sync) {
+        static const char* modes[] = {"Connecting", "Streaming", "Polling"};
+        std::string fileName;
+        long long pos = 0;
+        bool isOffset = true;
+        sync->position(fileName, pos, isOffset);
+        m_iobuf->appendFormatString("Master=%s:%d\n", sync->masterAddress().ip(), sync->masterAddress().port());
+        m_iobuf->appendFormatString("SyncMode=%s\n", modes[sync->mode()]);
+        m_iobuf->appendFormatString("MasterPosition=%s:%lld (%s)\n", fileName.c_str(), pos,
+                                    isOffset ? "offset" : "record");
+    }
+}
+
+void CFormatMonitorToIoBuf::formatBinlogWriterToIoBuf(CProxyMonitor& proxyMonirot) {
+    LeveldbCluster* cluster = proxyMonirot.redisProxy()->leveldbCluster();
+    if (!cluster) {
+        return;
+    }
+    BinlogWriter* writer = cluster->binlogWriter();
+    m_iobuf->append("\n[BinlogWriter]\n");
+    m_iobuf->appendFormatString("Running=%s\n", writer->isRunning() ? "Yes" : "No");
+    if (!writer->isRunning()) {
+        return;
+    }
+    BinlogWriter::Stats stats;
+    writer->stats(&stats);
+    m_iobuf->appendFormatString("SyncMode=%s\n", BinlogWriter::syncModeName(writer->option().syncMode));
+    m_iobuf->appendFormatString("QueueDepth=%lld\n", stats.queueDepth);
+    m_iobuf->appendFormatString("Records=%llu\n", stats.records);
+    m_iobuf->appendFormatString("Batches=%llu\n", stats.batches);
+    m_iobuf->appendFormatString("Bytes=%llu\n", stats.bytes);
+    m_iobuf->appendFormatString("Syncs=%llu\n", stats.syncs);
+    m_iobuf->appendFormatString("LastFlushUsec=%lld\n", stats.lastFlushUsec);
+    m_iobuf->appendFormatString("AvgFlushUsec=%lld\n", stats.avgFlushUsec);
+    m_iobuf->appendFormatString("MaxFlushUsec=%lld\n", stats.maxFlushUsec);
+}
+
 void CShowMonitor::showMonitorToIobuf(CFormatMonitorToIoBuf& formatMonitor,CProxyMonitor& monitor) {
     formatMonitor.formatProxyToIoBuf(monitor);
     formatMonitor.formatClientsToIoBuf(monitor);
+    formatMonitor.formatWriteThrottleToIoBuf(monitor);
+    formatMonitor.formatBlobStoreToIoBuf(monitor);
+    formatMonitor.formatObjectCacheToIoBuf(monitor);
+    formatMonitor.formatReadCoalescingToIoBuf(monitor);
+    formatMonitor.formatReplicationToIoBuf(monitor);
+    formatMonitor.formatBinlogWriterToIoBuf(monitor);
 }
 
 bool CShowMonitor::showMonitorToFile(
@@ -432,6 +587,12 @@ bool CShowMonitor::showMonitorToFile(
     }
     formatMonitor.formatProxyToIoBuf(monitor);
     formatMonitor.formatClientsToIoBuf(monitor);
+    formatMonitor.formatWriteThrottleToIoBuf(monitor);
+    formatMonitor.formatBlobStoreToIoBuf(monitor);
+    formatMonitor.formatObjectCacheToIoBuf(monitor);
+    formatMonitor.formatReadCoalescingToIoBuf(monitor);
+    formatMonitor.formatReplicationToIoBuf(monitor);
+    formatMonitor.formatBinlogWriterToIoBuf(monitor);
     formatMonitor.m_iobuf->append("\0", 1);
     CFileOperate::formatString2File(formatMonitor.m_iobuf->data(), formatMonitor.m_pfile);
     fclose(formatMonitor.m_pfile);
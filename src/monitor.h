@@ -154,6 +154,12 @@ public:
     ~CFormatMonitorToIoBuf(){}
     void formatProxyToIoBuf(CProxyMonitor& proxyMonirot);
     void formatClientsToIoBuf(CProxyMonitor& proxyMonirot);
+    void formatWriteThrottleToIoBuf(CProxyMonitor& proxyMonirot);
+    void formatBlobStoreToIoBuf(CProxyMonitor& proxyMonirot);
+    void formatObjectCacheToIoBuf(CProxyMonitor& proxyMonirot);
+    void formatReadCoalescingToIoBuf(CProxyMonitor& proxyMonirot);
+    void formatReplicationToIoBuf(CProxyMonitor& proxyMonirot);
+    void formatBinlogWriterToIoBuf(CProxyMonitor& proxyMonirot);
 
     void formatTopKeyToIoBuf(CProxyMonitor& proxyMonirot);
     void formatTopValueToIoBuf(CProxyMonitor& proxyMonirot);
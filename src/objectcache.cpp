@@ -0,0 +1,289 @@
+﻿/*
+* Licensed to the Apache Software Foundation (ASF) under one
+* or more contributor license agreements.  See the NOTICE file
+* distributed with this work for additional information
+* regarding copyright ownership.  The ASF licenses this file
+* to you under the Apache License, Version 2.0 (the
+* "License"); you may not use this file except in compliance
+* with the License.  You may obtain a copy of the License at
+*
+*   http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing,
+* software distributed under the License is distributed on an
+* "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+* KIND, either express or implied.  See the License for the
+* specific language governing permissions and limitations
+* under the License.
+*/
+
+#include <string.h>
+
+#include "objectcache.h"
+
+FrequencySketch::FrequencySketch(void)
+{
+    m_width = 0;
+    m_additions = 0;
+    m_sampleSize = 0;
+}
+
+FrequencySketch::~FrequencySketch(void)
+{
+}
+
+void FrequencySketch::init(int width)
+{
+    m_width = 1;
+    while (m_width < width) {
+        m_width <<= 1;
+    }
+    m_table.assign(m_width * Depth, 0);
+    m_additions = 0;
+    m_sampleSize = m_width * 10;
+}
+
+int FrequencySketch::indexOf(unsigned int hash, int row) const
+{
+    static const unsigned int seeds[Depth] = { 0x97cb3127, 0xc3a5c85c, 0x85ebca6b, 0x2545f491 };
+    unsigned int h = hash * seeds[row];
+    h ^= h >> 17;
+    return row * m_width + (h & (m_width - 1));
+}
+
+void FrequencySketch::increment(unsigned int hash)
+{
+    if (m_width == 0) {
+        return;
+    }
+    bool added = false;
+    for (int i = 0; i < Depth; ++i) {
+        unsigned char& c = m_table[indexOf(hash, i)];
+        if (c < MaxCount) {
+            ++c;
+            added = true;
+        }
+    }
+    if (added && ++m_additions >= m_sampleSize) {
+        reset();
+    }
+}
+
+int FrequencySketch::frequency(unsigned int hash) const
+{
+    if (m_width == 0) {
+        return 0;
+    }
+    int freq = MaxCount;
+    for (int i = 0; i < Depth; ++i) {
+        int c = m_table[indexOf(hash, i)];
+        if (c < freq) {
+            freq = c;
+        }
+    }
+    return freq;
+}
+
+//Aging: halve all the counters so old popularity fades out
+void FrequencySketch::reset(void)
+{
+    for (unsigned int i = 0; i < m_table.size(); ++i) {
+        m_table[i] >>= 1;
+    }
+    m_additions /= 2;
+}
+
+
+
+ObjectCache::ObjectCache(void)
+{
+    m_shardCapacity = 0;
+}
+
+ObjectCache::~ObjectCache(void)
+{
+    freeShards();
+}
+
+void ObjectCache::freeShards(void)
+{
+    for (unsigned int i = 0; i < m_shards.size(); ++i) {
+        delete m_shards[i];
+    }
+    m_shards.clear();
+}
+
+void ObjectCache::setOption(const Option& opt)
+{
+    freeShards();
+    m_option = opt;
+    if (m_option.shards <= 0) {
+        m_option.shards = 1;
+    }
+    if (!m_option.enabled) {
+        return;
+    }
+
+    m_shardCapacity = m_option.capacity / m_option.shards;
+    int width = (int)(m_shardCapacity / 512);
+    if (width < 256) {
+        width = 256;
+    }
+    if (width > (1 << 20)) {
+        width = (1 << 20);
+    }
+    for (int i = 0; i < m_option.shards; ++i) {
+        Shard* shard = new Shard;
+        shard->bytes = 0;
+        shard->generation = 0;
+        shard->sketch.init(width);
+        shard->hits = 0;
+        shard->misses = 0;
+        shard->inserts = 0;
+        shard->rejects = 0;
+        shard->evictions = 0;
+        shard->invalidations = 0;
+        m_shards.push_back(shard);
+    }
+}
+
+bool ObjectCache::lookup(const XObject& key, std::string& val)
+{
+    unsigned int hash = hashForBytes(key.data, key.len);
+    Shard* shard = shardOf(hash);
+    bool found = false;
+
+    shard->lock.lock();
+    shard->sketch.increment(hash);
+    EntryMap::iterator it = shard->index.find(std::string(key.data, key.len));
+    if (it != shard->index.end()) {
+        shard->lru.splice(shard->lru.begin(), shard->lru, it->second);
+        val = it->second->value;
+        shard->hits++;
+        found = true;
+    } else {
+        shard->misses++;
+    }
+    shard->lock.unlock();
+    return found;
+}
+
+unsigned long long ObjectCache::generation(const XObject& key)
+{
+    Shard* shard = shardOf(hashForBytes(key.data, key.len));
+    shard->lock.lock();
+    unsigned long long gen = shard->generation;
+    shard->lock.unlock();
+    return gen;
+}
+
+void ObjectCache::insert(const XObject& key, const std::string& val, unsigned long long generation)
+{
+    if (val.size() > m_option.maxValueSize) {
+        return;
+    }
+
+    unsigned int hash = hashForBytes(key.data, key.len);
+    Shard* shard = shardOf(hash);
+    std::string _key(key.data, key.len);
+
+    shard->lock.lock();
+    if (shard->generation != generation) {
+        //Written since the value was read
+        shard->lock.unlock();
+        return;
+    }
+
+    EntryMap::iterator it = shard->index.find(_key);
+    if (it != shard->index.end()) {
+        Entry& e = *it->second;
+        shard->bytes -= entrySize(e);
+        e.value = val;
+        shard->bytes += entrySize(e);
+        shard->lru.splice(shard->lru.begin(), shard->lru, it->second);
+        shard->lock.unlock();
+        return;
+    }
+
+    Entry entry;
+    entry.key.swap(_key);
+    entry.value = val;
+    entry.hash = hash;
+    size_t size = entrySize(entry);
+    if (size > m_shardCapacity) {
+        shard->lock.unlock();
+        return;
+    }
+
+    //TinyLFU admission: the candidate must be more popular than the victim
+    if (shard->bytes + size > m_shardCapacity && !shard->lru.empty()) {
+        const Entry& victim = shard->lru.back();
+        if (shard->sketch.frequency(hash) <= shard->sketch.frequency(victim.hash)) {
+            shard->rejects++;
+            shard->lock.unlock();
+            return;
+        }
+    }
+    while (shard->bytes + size > m_shardCapacity && !shard->lru.empty()) {
+        Entry& victim = shard->lru.back();
+        shard->bytes -= entrySize(victim);
+        shard->index.erase(victim.key);
+        shard->lru.pop_back();
+        shard->evictions++;
+    }
+
+    shard->lru.push_front(Entry());
+    shard->lru.front().key.swap(entry.key);
+    shard->lru.front().value.swap(entry.value);
+    shard->lru.front().hash = hash;
+    shard->index[shard->lru.front().key] = shard->lru.begin();
+    shard->bytes += size;
+    shard->inserts++;
+    shard->lock.unlock();
+}
+
+void ObjectCache::invalidate(const XObject& key)
+{
+    Shard* shard = shardOf(hashForBytes(key.data, key.len));
+    shard->lock.lock();
+    shard->generation++;
+    EntryMap::iterator it = shard->index.find(std::string(key.data, key.len));
+    if (it != shard->index.end()) {
+        shard->bytes -= entrySize(*it->second);
+        shard->lru.erase(it->second);
+        shard->index.erase(it);
+        shard->invalidations++;
+    }
+    shard->lock.unlock();
+}
+
+void ObjectCache::clear(void)
+{
+    for (unsigned int i = 0; i < m_shards.size(); ++i) {
+        Shard* shard = m_shards[i];
+        shard->lock.lock();
+        shard->generation++;
+        shard->lru.clear();
+        shard->index.clear();
+        shard->bytes = 0;
+        shard->lock.unlock();
+    }
+}
+
+void ObjectCache::stats(Stats* stats)
+{
+    memset(stats, 0, sizeof(Stats));
+    for (unsigned int i = 0; i < m_shards.size(); ++i) {
+        Shard* shard = m_shards[i];
+        shard->lock.lock();
+        stats->hits += shard->hits;
+        stats->misses += shard->misses;
+        stats->inserts += shard->inserts;
+        stats->rejects += shard->rejects;
+        stats->evictions += shard->evictions;
+        stats->invalidations += shard->invalidations;
+        stats->entries += shard->index.size();
+        stats->bytes += shard->bytes;
+        shard->lock.unlock();
+    }
+}
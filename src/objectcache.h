@@ -0,0 +1,145 @@
+﻿/*
+* Licensed to the Apache Software Foundation (ASF) under one
+* or more contributor license agreements.  See the NOTICE file
+* distributed with this work for additional information
+* regarding copyright ownership.  The ASF licenses this file
+* to you under the Apache License, Version 2.0 (the
+* "License"); you may not use this file except in compliance
+* with the License.  You may obtain a copy of the License at
+*
+*   http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing,
+* software distributed under the License is distributed on an
+* "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+* KIND, either express or implied.  See the License for the
+* specific language governing permissions and limitations
+* under the License.
+*/
+
+#ifndef OBJECTCACHE_H
+#define OBJECTCACHE_H
+
+#include <string>
+#include <list>
+#include <vector>
+#include <unordered_map>
+
+#include "util/locker.h"
+#include "leveldb.h"
+
+/*
+    In-process cache of decoded values keyed by the internal key
+
+    The cache is split into shards, each shard is an LRU list protected
+    by its own mutex. A new key is only admitted into a full shard when
+    its estimated access frequency (count-min sketch, TinyLFU) is higher
+    than the one of the LRU victim, so a scan can't flush the hot keys.
+
+    A loader remembers the shard generation before reading the database,
+    the writers bump it when they invalidate a key, so a value read before
+    a concurrent write is never inserted.
+*/
+class FrequencySketch
+{
+public:
+    FrequencySketch(void);
+    ~FrequencySketch(void);
+
+    void init(int width);
+    void increment(unsigned int hash);
+    int frequency(unsigned int hash) const;
+
+private:
+    void reset(void);
+    int indexOf(unsigned int hash, int row) const;
+
+private:
+    enum { Depth = 4, MaxCount = 15 };
+    std::vector<unsigned char> m_table;
+    int m_width;
+    int m_additions;
+    int m_sampleSize;
+};
+
+class ObjectCache
+{
+public:
+    struct Option {
+        bool enabled;
+        size_t capacity;
+        size_t maxValueSize;
+        int shards;
+
+        Option(void) {
+            enabled = false;
+            capacity = 256 * 1024 * 1024;
+            maxValueSize = 64 * 1024;
+            shards = 16;
+        }
+    };
+
+    struct Stats {
+        unsigned long long hits;
+        unsigned long long misses;
+        unsigned long long inserts;
+        unsigned long long rejects;
+        unsigned long long evictions;
+        unsigned long long invalidations;
+        unsigned long long entries;
+        unsigned long long bytes;
+    };
+
+    ObjectCache(void);
+    ~ObjectCache(void);
+
+    void setOption(const Option& opt);
+    const Option& option(void) const { return m_option; }
+    bool isEnabled(void) const { return m_option.enabled; }
+
+    bool lookup(const XObject& key, std::string& val);
+    //Take it before reading the database, pass it to insert()
+    unsigned long long generation(const XObject& key);
+    void insert(const XObject& key, const std::string& val, unsigned long long generation);
+    void invalidate(const XObject& key);
+    void clear(void);
+
+    void stats(Stats* stats);
+
+private:
+    struct Entry {
+        std::string key;
+        std::string value;
+        unsigned int hash;
+    };
+    typedef std::list<Entry> EntryList;
+    typedef std::unordered_map<std::string, EntryList::iterator> EntryMap;
+
+    struct Shard {
+        Mutex lock;
+        EntryList lru;              //front is the most recently used
+        EntryMap index;
+        size_t bytes;
+        unsigned long long generation;
+        FrequencySketch sketch;
+        unsigned long long hits;
+        unsigned long long misses;
+        unsigned long long inserts;
+        unsigned long long rejects;
+        unsigned long long evictions;
+        unsigned long long invalidations;
+    };
+
+    Shard* shardOf(unsigned int hash) { return m_shards[hash % m_shards.size()]; }
+    static size_t entrySize(const Entry& e) { return e.key.size() + e.value.size() + sizeof(Entry); }
+    void freeShards(void);
+
+private:
+    Option m_option;
+    size_t m_shardCapacity;
+    std::vector<Shard*> m_shards;
+    ObjectCache(const ObjectCache&);
+    ObjectCache& operator=(const ObjectCache&);
+};
+
+#endif
@@ -129,6 +129,7 @@ void COneValueCfg::getRootAttr(const TiXmlElement* pRootNode) {
 
 COption::COption() {
     m_sync = false;
+    m_readCoalescing = false;
     m_compress = false;
     m_lruCacheSize = 0;
     m_writeBufSize = 4;
@@ -148,6 +149,12 @@ void COneValueCfg::getDbOption(const TiXmlAttribute* addrAttr) {
             }
             continue;
         }
+        if (0 == strcasecmp(name, "read_coalescing")) {
+            if (atoi(value) > 0) {
+                m_option.m_readCoalescing = true;
+            }
+            continue;
+        }
         if (0 == strcasecmp(name, "compress")) {
             if (atoi(value) > 0) {
                 m_option.m_compress = true;
@@ -191,6 +198,27 @@ void COneValueCfg::getBinLog(const TiXmlAttribute* addrAttr) {
             if (iValue > 0) {
                 m_binlog._enabled = true;
             }
+            continue;
+        }
+        if (0 == strcasecmp(name, "writer")) {
+            m_binlog._writer = (iValue > 0);
+            continue;
+        }
+        if (0 == strcasecmp(name, "sync_mode")) {
+            if (0 == strcasecmp(value, "interval")) {
+                m_binlog.sync_mode = 1;
+            } else if (0 == strcasecmp(value, "batch")) {
+                m_binlog.sync_mode = 2;
+            } else {
+                m_binlog.sync_mode = 0;
+            }
+            continue;
+        }
+        if (0 == strcasecmp(name, "sync_interval")) {
+            if (iValue > 0) {
+                m_binlog.sync_interval = iValue;
+            }
+            continue;
         }
     }
 }
@@ -214,6 +242,146 @@ void COneValueCfg::getMaster(const TiXmlAttribute* addrAttr) {
     }
 }
 
+void COneValueCfg::getWriteThrottle(const TiXmlAttribute* addrAttr) {
+    for (; addrAttr != NULL; addrAttr = addrAttr->Next()) {
+        const char* name = addrAttr->Name();
+        const char* value = addrAttr->Value();
+        int iValue = atoi(value);
+        if (0 == strcasecmp(name, "enabled")) {
+            if (iValue > 0) {
+                m_writeThrottle._enabled = true;
+            }
+            continue;
+        }
+        if (0 == strcasecmp(name, "slowdown_l0_files")) {
+            if (iValue > 0) {
+                m_writeThrottle.slowdown_l0_files = iValue;
+            }
+            continue;
+        }
+        if (0 == strcasecmp(name, "stop_l0_files")) {
+            if (iValue > 0) {
+                m_writeThrottle.stop_l0_files = iValue;
+            }
+            continue;
+        }
+        if (0 == strcasecmp(name, "slowdown_pending_size")) {
+            if (iValue > 0) {
+                m_writeThrottle.slowdown_pending_size = iValue;
+            }
+            continue;
+        }
+        if (0 == strcasecmp(name, "stop_pending_size")) {
+            if (iValue > 0) {
+                m_writeThrottle.stop_pending_size = iValue;
+            }
+            continue;
+        }
+        if (0 == strcasecmp(name, "max_delay")) {
+            if (iValue >= 0) {
+                m_writeThrottle.max_delay = iValue;
+            }
+            continue;
+        }
+    }
+}
+
+void COneValueCfg::getBlob(const TiXmlAttribute* addrAttr) {
+    for (; addrAttr != NULL; addrAttr = addrAttr->Next()) {
+        const char* name = addrAttr->Name();
+        const char* value = addrAttr->Value();
+        int iValue = atoi(value);
+        if (0 == strcasecmp(name, "enabled")) {
+            if (iValue > 0) {
+                m_blob._enabled = true;
+            }
+            continue;
+        }
+        if (0 == strcasecmp(name, "min_blob_size")) {
+            if (iValue > 0) {
+                m_blob.min_blob_size = iValue;
+            }
+            continue;
+        }
+        if (0 == strcasecmp(name, "max_file_size")) {
+            if (iValue > 0) {
+                m_blob.max_file_size = iValue;
+            }
+            continue;
+        }
+        if (0 == strcasecmp(name, "gc_ratio")) {
+            if (iValue > 0 && iValue <= 100) {
+                m_blob.gc_ratio = iValue;
+            }
+            continue;
+        }
+        if (0 == strcasecmp(name, "gc_interval")) {
+            if (iValue > 0) {
+                m_blob.gc_interval = iValue;
+            }
+            continue;
+        }
+    }
+}
+
+void COneValueCfg::getStringChunk(const TiXmlAttribute* addrAttr) {
+    for (; addrAttr != NULL; addrAttr = addrAttr->Next()) {
+        const char* name = addrAttr->Name();
+        const char* value = addrAttr->Value();
+        int iValue = atoi(value);
+        if (0 == strcasecmp(name, "enabled")) {
+            if (iValue > 0) {
+                m_stringChunk._enabled = true;
+            }
+            continue;
+        }
+        if (0 == strcasecmp(name, "threshold")) {
+            if (iValue > 0) {
+                m_stringChunk.threshold = iValue;
+            }
+            continue;
+        }
+        if (0 == strcasecmp(name, "chunk_size")) {
+            if (iValue > 0) {
+                m_stringChunk.chunk_size = iValue;
+            }
+            continue;
+        }
+    }
+}
+
+void COneValueCfg::getCache(const TiXmlAttribute* addrAttr) {
+    for (; addrAttr != NULL; addrAttr = addrAttr->Next()) {
+        const char* name = addrAttr->Name();
+        const char* value = addrAttr->Value();
+        int iValue = atoi(value);
+        if (0 == strcasecmp(name, "enabled")) {
+            if (iValue > 0) {
+                m_cache._enabled = true;
+            }
+            continue;
+        }
+        if (0 == strcasecmp(name, "size")) {
+            if (iValue > 0) {
+                m_cache.size = iValue;
+            }
+            continue;
+        }
+        if (0 == strcasecmp(name, "max_value_size")) {
+            if (iValue > 0) {
+                m_cache.max_value_size = iValue;
+            }
+            continue;
+        }
+        if (0 == strcasecmp(name, "shards")) {
+            if (iValue > 0) {
+                m_cache.shards = iValue;
+            }
+            continue;
+        }
+    }
+}
+
 
 bool COneValueCfg::loadCfg(const char* file) {
     if (!m_operateXmlPointer->xml_open(file)) return false;
@@ -254,6 +422,30 @@ bool COneValueCfg::loadCfg(const char* file) {
             continue;
         }
 
+        if (0 == strcasecmp(pNode->Value(), "write_throttle")) {
+            TiXmlAttribute *addrAttr = (TiXmlAttribute*)pNode->FirstAttribute();
+            getWriteThrottle(addrAttr);
+            continue;
+        }
+
+        if (0 == strcasecmp(pNode->Value(), "blob")) {
+            TiXmlAttribute *addrAttr = (TiXmlAttribute*)pNode->FirstAttribute();
+            getBlob(addrAttr);
+            continue;
+        }
+
+        if (0 == strcasecmp(pNode->Value(), "string_chunk")) {
+            TiXmlAttribute *addrAttr = (TiXmlAttribute*)pNode->FirstAttribute();
+            getStringChunk(addrAttr);
+            continue;
+        }
+
+        if (0 == strcasecmp(pNode->Value(), "cache")) {
+            TiXmlAttribute *addrAttr = (TiXmlAttribute*)pNode->FirstAttribute();
+            getCache(addrAttr);
+            continue;
+        }
+
         if (0 == strcasecmp(pNode->Value(), "db_node")) {
             CDbNode dbNode;
             TiXmlAttribute *addrAttr = (TiXmlAttribute*)pNode->FirstAttribute();
@@ -335,5 +527,17 @@ bool COneValueCfgChecker::isValid(COneValueCfg* pCfg, const char*& errMsg)
         return false;
     }
 
+    CWriteThrottle* throttle = pCfg->writeThrottle();
+    if (throttle->enabled()) {
+        if (throttle->slowdownL0Files() >= throttle->stopL0Files()) {
+            errMsg = "write_throttle: slowdown_l0_files >= stop_l0_files";
+            return false;
+        }
+        if (throttle->slowdownPendingSize() >= throttle->stopPendingSize()) {
+            errMsg = "write_throttle: slowdown_pending_size >= stop_pending_size";
+            return false;
+        }
+    }
+
     return true;
 }
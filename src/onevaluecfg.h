@@ -71,6 +71,7 @@ public:
     COption();
     ~COption();
     bool sync() const {return m_sync;}
+    bool readCoalescing() const {return m_readCoalescing;}
     bool compress() const {return m_compress;}
     int lruCacheSize()const {return m_lruCacheSize * 1024 * 1024;} // return bit
     int writeBufSize()const {return m_writeBufSize * 1024 * 1024;}
@@ -78,6 +79,7 @@ public:
     int maxFileSize() const {return m_maxfilesize * 1024 * 1024; }
 private:
     bool m_sync;
+    bool m_readCoalescing;
     bool m_compress;
     int m_lruCacheSize;
     int m_writeBufSize;
@@ -88,7 +90,13 @@ private:
 
 class CBinLog {
 public:
-    CBinLog() { max_binlog_size = 0; _enabled = false;}
+    CBinLog() {
+        max_binlog_size = 0;
+        _enabled = false;
+        _writer = true;
+        sync_mode = 0;
+        sync_interval = 1000;
+    }
     unsigned int maxBinlogSize() {
         if (max_binlog_size <= 0) {
             return 1024 * 1024 * 2;
@@ -96,9 +104,102 @@ public:
         return max_binlog_size * 1024 * 1024;
     }
     bool enabled() { return _enabled; }
+    bool writerEnabled() const { return _writer; }
+    int syncMode() const { return sync_mode; }
+    int syncInterval() const { return sync_interval; }
 private:
     bool _enabled;
     int max_binlog_size; // bits;
+    bool _writer;
+    int sync_mode;       // 0=none 1=interval 2=batch
+    int sync_interval;   // msec
+    friend class COneValueCfg;
+};
+
+
+class CWriteThrottle {
+public:
+    CWriteThrottle() {
+        _enabled = false;
+        slowdown_l0_files = 6;
+        stop_l0_files = 10;
+        slowdown_pending_size = 256;
+        stop_pending_size = 1024;
+        max_delay = 100;
+    }
+    bool enabled() const { return _enabled; }
+    int slowdownL0Files() const { return slowdown_l0_files; }
+    int stopL0Files() const { return stop_l0_files; }
+    size_t slowdownPendingSize() const { return (size_t)slowdown_pending_size * 1024 * 1024; }
+    size_t stopPendingSize() const { return (size_t)stop_pending_size * 1024 * 1024; }
+    int maxDelay() const { return max_delay; }
+private:
+    bool _enabled;
+    int slowdown_l0_files;
+    int stop_l0_files;
+    int slowdown_pending_size; // MB
+    int stop_pending_size;     // MB
+    int max_delay;             // msec
+    friend class COneValueCfg;
+};
+
+class CBlob {
+public:
+    CBlob() {
+        _enabled = false;
+        min_blob_size = 64;
+        max_file_size = 256;
+        gc_ratio = 50;
+        gc_interval = 60;
+    }
+    bool enabled() const { return _enabled; }
+    size_t minBlobSize() const { return (size_t)min_blob_size * 1024; }
+    size_t maxFileSize() const { return (size_t)max_file_size * 1024 * 1024; }
+    int gcRatio() const { return gc_ratio; }
+    int gcInterval() const { return gc_interval; }
+private:
+    bool _enabled;
+    int min_blob_size;  // KB
+    int max_file_size;  // MB
+    int gc_ratio;       // percent
+    int gc_interval;    // sec
+    friend class COneValueCfg;
+};
+
+class CStringChunk {
+public:
+    CStringChunk() {
+        _enabled = false;
+        threshold = 1024;
+        chunk_size = 64;
+    }
+    bool enabled() const { return _enabled; }
+    int thresholdSize() const { return threshold * 1024; }
+    int chunkSize() const { return chunk_size * 1024; }
+private:
+    bool _enabled;
+    int threshold;      // KB
+    int chunk_size;     // KB
+    friend class COneValueCfg;
+};
+
+class CCache {
+public:
+    CCache() {
+        _enabled = false;
+        size = 256;
+        max_value_size = 64;
+        shards = 16;
+    }
+    bool enabled() const { return _enabled; }
+    size_t capacity() const { return (size_t)size * 1024 * 1024; }
+    size_t maxValueSize() const { return (size_t)max_value_size * 1024; }
+    int shardCount() const { return shards; }
+private:
+    bool _enabled;
+    int size;               // MB
+    int max_value_size;     // KB
+    int shards;
     friend class COneValueCfg;
 };
 
@@ -140,11 +241,19 @@ public:
 
     CBinLog* binlog() {return &m_binlog;}
     SMaster* master() {return &m_master;}
+    CWriteThrottle* writeThrottle() {return &m_writeThrottle;}
+    CBlob* blob() {return &m_blob;}
+    CStringChunk* stringChunk() {return &m_stringChunk;}
+    CCache* cache() {return &m_cache;}
 private:
     void getRootAttr(const TiXmlElement* pRootNode);
     void getDbOption(const TiXmlAttribute* pRootNode);
     void getBinLog(const TiXmlAttribute* pEle);
     void getMaster(const TiXmlAttribute* pEle);
+    void getWriteThrottle(const TiXmlAttribute* pEle);
+    void getBlob(const TiXmlAttribute* pEle);
+    void getStringChunk(const TiXmlAttribute* pEle);
+    void getCache(const TiXmlAttribute* pEle);
 private:
     COperateXml*     m_operateXmlPointer;
     int              m_threadNum;
@@ -161,6 +270,10 @@ private:
     COption          m_option;
     CBinLog          m_binlog;
     SMaster          m_master;
+    CWriteThrottle   m_writeThrottle;
+    CBlob            m_blob;
+    CStringChunk     m_stringChunk;
+    CCache           m_cache;
 private:
     COneValueCfg(const COneValueCfg&);
     COneValueCfg& operator =(const COneValueCfg&);
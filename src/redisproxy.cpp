@@ -22,6 +22,7 @@
 #include "cmdhandler.h"
 #include "non-portable.h"
 #include "sync.h"
+#include "writethrottle.h"
 #include "redisproxy.h"
 
 void ClientPacket::setFinishedState(State state)
@@ -112,6 +113,7 @@ bool RedisProxy::run(const HostAddress &addr)
 
     RedisCommandTable* cmdtable = RedisCommandTable::instance();
     cmdtable->registerCommand("__SYNC", RedisCommand::PrivType, onSyncCommand, this);
+    cmdtable->registerCommand("__REPLSTREAM", RedisCommand::PrivType, onReplStreamCommand, this);
     cmdtable->registerCommand("__COPY", RedisCommand::PrivType, onCopyCommand, NULL);
     cmdtable->registerCommand("SYNCFROM", -1, onSyncFromCommand, NULL);
 
@@ -212,9 +214,45 @@ void RedisProxy::readRequestFinished(Context *c)
     }
 
     packet->commandType = command->type;
+    if (RedisCommand::isWriteCommand(command->type) && !admitWriteCommand(packet)) {
+        return;
+    }
     command->handler(packet, command->arg);
 }
 
+bool RedisProxy::admitWriteCommand(ClientPacket* packet)
+{
+    WriteThrottle* throttle = m_leveldbCluster->writeThrottle();
+    switch (throttle->state()) {
+    case WriteThrottle::Stop:
+        throttle->writeRejected();
+        packet->writeDelayed = false;
+        packet->sendBuff.append("-BUSY write stalled by compaction, try again later\r\n");
+        packet->setFinishedState(ClientPacket::RequestFinished);
+        return false;
+    case WriteThrottle::Slowdown:
+        //Stop reading from this connection for a while, the event loop keeps running
+        if (!packet->writeDelayed) {
+            throttle->writeDelayed();
+            packet->writeDelayed = true;
+            packet->delayEvent.setTimer(packet->eventLoop, delayedWriteHandler, packet);
+            packet->delayEvent.active(throttle->writeDelay());
+            return false;
+        }
+        break;
+    default:
+        break;
+    }
+    packet->writeDelayed = false;
+    return true;
+}
+
+void RedisProxy::delayedWriteHandler(socket_t, short, void* arg)
+{
+    ClientPacket* packet = (ClientPacket*)arg;
+    packet->proxy()->readRequestFinished(packet);
+}
+
 void RedisProxy::writeReply(Context *c)
 {
     ClientPacket* packet = (ClientPacket*)c;
@@ -46,6 +46,7 @@ public:
     ClientPacket(void) {
         commandType = -1;
         recvBufferOffset = 0;
+        writeDelayed = false;
     }
 
     ~ClientPacket(void) {}
@@ -57,6 +58,8 @@ public:
     int commandType;
     int recvBufferOffset;
     RedisProtoParseResult recvParseResult;
+    bool writeDelayed;          //The current write command has been delayed once
+    Event delayEvent;           //Write throttle timer
 };
 
 
@@ -124,7 +127,9 @@ public:
     virtual void writeReplyFinished(Context* c);
 
 private:
+    bool admitWriteCommand(ClientPacket* packet);
     static void vipHandler(socket_t, short, void*);
+    static void delayedWriteHandler(socket_t, short, void*);
 
 private:
     Monitor* m_monitor;
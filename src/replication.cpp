@@ -0,0 +1,685 @@
+﻿/*
+* Licensed to the Apache Software Foundation (ASF) under one
+* or more contributor license agreements.  See the NOTICE file
+* distributed with this work for additional information
+* regarding copyright ownership.  The ASF licenses this file
+* to you under the Apache License, Version 2.0 (the
+* "License"); you may not use this file except in compliance
+* with the License.  You may obtain a copy of the License at
+*
+*   http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing,
+* software distributed under the License is distributed on an
+* "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+* KIND, either express or implied.  See the License for the
+* specific language governing permissions and limitations
+* under the License.
+*/
+
+#ifndef WIN32
+#include <fcntl.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#endif
+
+#include <stdio.h>
+#include <string.h>
+#include <limits.h>
+#include <algorithm>
+
+#include "util/thread.h"
+#include "util/logger.h"
+#include "binlog.h"
+#include "replication.h"
+
+#ifndef MSG_DONTWAIT
+#define MSG_DONTWAIT 0
+#endif
+
+static long long currentMsec(void)
+{
+#ifdef WIN32
+    return (long long)::GetTickCount();
+#else
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return (long long)tv.tv_sec * 1000 + tv.tv_usec / 1000;
+#endif
+}
+
+
+class ReplicaSender : public Thread
+{
+public:
+    enum {
+        BatchSize = 1024*1024,          //binlog bytes read per frame
+        WindowSize = 8*1024*1024,       //max bytes sent but not acknowledged
+        HeartbeatInterval = 1000,       //msec
+        AckTimeout = 30*1000,           //msec
+        SendTimeout = 30*1000           //msec
+    };
+
+    ReplicaSender(LeveldbCluster* cluster, socket_t sock, const HostAddress& addr);
+    ~ReplicaSender(void);
+
+    bool locate(const std::string& fileName, long long position, bool isRecordIndex, std::string& err);
+    void sendError(const std::string& err);
+    void stop(void);
+    bool isFinished(void) const { return m_finished; }
+    void info(ReplicationMaster::ReplicaInfo* info);
+
+protected:
+    virtual void run(void);
+
+private:
+    bool openFile(const std::string& baseName);
+    void closeFile(void);
+    long long readableSize(bool* isActive, std::string* nextFileName);
+    bool walkRecords(int count, long long stopOffset);
+    int readRecords(int* itemCount);
+    void waitRecords(int msec);
+    bool sendFrame(int type, const char* payload, int size, int itemCount);
+    bool sendAll(const char* buff, int len);
+    bool readAcks(bool wait);
+
+private:
+    LeveldbCluster* m_cluster;
+    TcpSocket m_socket;
+    HostAddress m_addr;
+    volatile bool m_stopped;
+    volatile bool m_finished;
+
+    //Read cursor
+    std::string m_fileName;         //binlog base name
+    int m_fd;
+    long long m_offset;             //byte offset of the next record
+    std::string m_buff;
+
+    long long m_sentOffset;
+    long long m_ackedOffset;
+    std::string m_ackedFileName;
+    long long m_ackedPos;
+    long long m_lastAckTime;
+    std::string m_ackBuff;
+
+    Mutex m_infoLock;
+};
+
+ReplicaSender::ReplicaSender(LeveldbCluster* cluster, socket_t sock, const HostAddress& addr) :
+    m_cluster(cluster),
+    m_socket(sock),
+    m_addr(addr),
+    m_stopped(false),
+    m_finished(false),
+    m_fd(-1),
+    m_offset(0),
+    m_sentOffset(0),
+    m_ackedOffset(0),
+    m_ackedPos(-1),
+    m_lastAckTime(0)
+{
+    m_socket.setBlocking();
+    m_socket.setNoDelay();
+    m_socket.setSendTimeout(SendTimeout);
+    m_socket.setRecvTimeout(HeartbeatInterval);
+}
+
+ReplicaSender::~ReplicaSender(void)
+{
+    closeFile();
+    m_socket.close();
+}
+
+bool ReplicaSender::locate(const std::string& fileName, long long position, bool isRecordIndex, std::string& err)
+{
+    std::string baseName = fileName;
+    bool valid = true;
+    m_cluster->lockCurrentBinlogFile();
+    BinlogFileList* flist = m_cluster->binlogFileList();
+    if (flist->isEmpty()) {
+        err = "binlog is not enabled";
+        valid = false;
+    } else if (baseName.empty() || baseName[0] == ' ') {
+        baseName = flist->fileName(0);
+        position = isRecordIndex ? -1 : 0;
+    } else if (flist->indexOfFileName(baseName) == -1) {
+        err = "invalid binlog file name";
+        valid = false;
+    }
+    m_cluster->unlockCurrentBinlogFile();
+
+    if (!valid) {
+        return false;
+    }
+    if (!openFile(baseName)) {
+        err = "open binlog file failed";
+        return false;
+    }
+
+    BinlogIndex index;
+    if (!m_cluster->binlogIndex(baseName, &index)) {
+        err = "read binlog index failed";
+        return false;
+    }
+    int first = 0;
+    bool ok = false;
+    if (isRecordIndex) {
+        //Resume after the record 'position'
+        int record = (int)position + 1;
+        m_offset = index.findRecord(record, &first);
+        ok = walkRecords(record - first, -1);
+    } else {
+        if (position < (long long)sizeof(Binlog::Header)) {
+            position = sizeof(Binlog::Header);
+        }
+        m_offset = index.findOffset(position, &first);
+        ok = walkRecords(INT_MAX, position) && m_offset == position;
+    }
+    if (!ok) {
+        err = "invalid binlog position";
+        return false;
+    }
+    m_ackedFileName = m_fileName;
+    m_ackedPos = m_offset;
+    return true;
+}
+
+void ReplicaSender::sendError(const std::string& err)
+{
+    ReplFrame frame;
+    memset(&frame, 0, sizeof(frame));
+    frame.magic = ReplFrame::Magic;
+    frame.type = ReplFrame::Error;
+    strncpy(frame.fileName, err.c_str(), sizeof(frame.fileName) - 1);
+    sendAll((char*)&frame, sizeof(frame));
+}
+
+void ReplicaSender::stop(void)
+{
+    m_stopped = true;
+#ifdef WIN32
+    ::shutdown(m_socket.socket(), SD_BOTH);
+#else
+    ::shutdown(m_socket.socket(), SHUT_RDWR);
+#endif
+}
+
+void ReplicaSender::info(ReplicationMaster::ReplicaInfo* info)
+{
+    char address[64];
+    sprintf(address, "%s:%d", m_addr.ip(), m_addr.port());
+    m_infoLock.lock();
+    info->address = address;
+    info->sentFileName = m_fileName;
+    info->sentPos = m_offset;
+    info->ackedFileName = m_ackedFileName;
+    info->ackedPos = m_ackedPos;
+    info->sentOffset = m_sentOffset;
+    info->ackedOffset = m_ackedOffset;
+    m_infoLock.unlock();
+}
+
+void ReplicaSender::run(void)
+{
+    Logger::log(Logger::Message, "Replica %s:%d: streaming from %s:%lld",
+                m_addr.ip(), m_addr.port(), m_fileName.c_str(), m_offset);
+
+    m_lastAckTime = currentMsec();
+    long long lastSendTime = m_lastAckTime;
+    bool ok = sendFrame(ReplFrame::Handshake, NULL, 0, 0);
+    while (ok && !m_stopped) {
+        if (!readAcks(false)) {
+            break;
+        }
+        long long now = currentMsec();
+        if (now - m_lastAckTime > AckTimeout) {
+            Logger::log(Logger::Warning, "Replica %s:%d: no acknowledgement for %d seconds",
+                        m_addr.ip(), m_addr.port(), AckTimeout / 1000);
+            break;
+        }
+        if (m_sentOffset - m_ackedOffset >= WindowSize) {
+            ok = readAcks(true);
+            continue;
+        }
+
+        int itemCount = 0;
+        int size = readRecords(&itemCount);
+        if (size < 0) {
+            break;
+        }
+        if (size > 0) {
+            ok = sendFrame(ReplFrame::Records, m_buff.data(), size, itemCount);
+            lastSendTime = now;
+            continue;
+        }
+        if (now - lastSendTime >= HeartbeatInterval) {
+            ok = sendFrame(ReplFrame::Heartbeat, NULL, 0, 0);
+            lastSendTime = now;
+            continue;
+        }
+        waitRecords(HeartbeatInterval - (int)(now - lastSendTime));
+    }
+
+    Logger::log(Logger::Message, "Replica %s:%d: stream closed at %s:%lld",
+                m_addr.ip(), m_addr.port(), m_fileName.c_str(), m_offset);
+#ifdef WIN32
+    ::shutdown(m_socket.socket(), SD_BOTH);
+#else
+    ::shutdown(m_socket.socket(), SHUT_RDWR);
+#endif
+    m_finished = true;
+}
+
+bool ReplicaSender::openFile(const std::string& baseName)
+{
+#ifndef WIN32
+    closeFile();
+    std::string path = m_cluster->binlogFileName(baseName);
+
+    //The header of a new binlog file may be still buffered
+    m_cluster->lockCurrentBinlogFile();
+    Binlog* curBinlog = m_cluster->currentBinlog();
+    if (curBinlog->fileName() == path) {
+        curBinlog->sync();
+    }
+    m_cluster->unlockCurrentBinlogFile();
+
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        Logger::log(Logger::Error, "ReplicaSender::openFile: open(%s): %s", path.c_str(), strerror(errno));
+        return false;
+    }
+    Binlog::Header header;
+    if (::pread(fd, &header, sizeof(header), 0) != sizeof(header) || !header.isValid()) {
+        Logger::log(Logger::Error, "ReplicaSender::openFile: %s invalid", path.c_str());
+        ::close(fd);
+        return false;
+    }
+
+    m_infoLock.lock();
+    m_fileName = baseName;
+    m_fd = fd;
+    m_offset = sizeof(Binlog::Header);
+    m_infoLock.unlock();
+    return true;
+#else
+    (void)baseName;
+    return false;
+#endif
+}
+
+void ReplicaSender::closeFile(void)
+{
+#ifndef WIN32
+    if (m_fd != -1) {
+        ::close(m_fd);
+        m_fd = -1;
+    }
+#endif
+}
+
+long long ReplicaSender::readableSize(bool* isActive, std::string* nextFileName)
+{
+    long long size = -1;
+    std::string path = m_cluster->binlogFileName(m_fileName);
+
+    m_cluster->lockCurrentBinlogFile();
+    Binlog* curBinlog = m_cluster->currentBinlog();
+    *isActive = (curBinlog->fileName() == path);
+    if (*isActive) {
+        curBinlog->sync();
+        size = curBinlog->writtenSize();
+    }
+    BinlogFileList* flist = m_cluster->binlogFileList();
+    int index = flist->indexOfFileName(m_fileName);
+    if (index != -1 && index + 1 < flist->fileCount()) {
+        *nextFileName = flist->fileName(index + 1);
+    }
+    m_cluster->unlockCurrentBinlogFile();
+
+#ifndef WIN32
+    if (!*isActive) {
+        struct stat sbuf;
+        if (::fstat(m_fd, &sbuf) == 0) {
+            size = sbuf.st_size;
+        }
+    }
+#endif
+    return size;
+}
+
+/* Skip count records from the cursor, or the records before stopOffset if it is not -1 */
+bool ReplicaSender::walkRecords(int count, long long stopOffset)
+{
+#ifndef WIN32
+    bool isActive;
+    std::string nextFileName;
+    long long size = readableSize(&isActive, &nextFileName);
+    if (size < 0) {
+        return false;
+    }
+    long long limit = (stopOffset >= 0 && stopOffset < size) ? stopOffset : size;
+
+    m_buff.resize(BatchSize);
+    while (count > 0 && m_offset < limit) {
+        int len = (int)std::min<long long>(BatchSize, size - m_offset);
+        int n = ::pread(m_fd, &m_buff[0], len, m_offset);
+        if (n <= 0) {
+            return false;
+        }
+        long long used = 0;
+        while (count > 0 && used + (long long)sizeof(Binlog::LogItem) <= n && m_offset + used < limit) {
+            Binlog::LogItem* item = (Binlog::LogItem*)(&m_buff[0] + used);
+            if (!item->hasValidHeader()) {
+                Logger::log(Logger::Error, "ReplicaSender::walkRecords: %s: invalid record at %lld",
+                            m_fileName.c_str(), m_offset + used);
+                return false;
+            }
+            if (m_offset + used + item->item_size > size) {
+                count = 0;
+                break;
+            }
+            used += item->item_size;
+            --count;
+        }
+        if (used == 0) {
+            break;
+        }
+        m_offset += used;
+    }
+    return true;
+#else
+    (void)count;
+    return false;
+#endif
+}
+
+int ReplicaSender::readRecords(int* itemCount)
+{
+#ifndef WIN32
+    long long size;
+    while (true) {
+        bool isActive;
+        std::string nextFileName;
+        size = readableSize(&isActive, &nextFileName);
+        if (size < 0) {
+            return -1;
+        }
+        if (m_offset < size) {
+            break;
+        }
+        if (isActive || nextFileName.empty()) {
+            return 0;
+        }
+        if (!openFile(nextFileName)) {
+            return -1;
+        }
+    }
+
+    int len = (int)std::min<long long>(BatchSize, size - m_offset);
+    m_buff.resize(len);
+    if (::pread(m_fd, &m_buff[0], len, m_offset) != len) {
+        Logger::log(Logger::Error, "ReplicaSender::readRecords: pread: %s", strerror(errno));
+        return -1;
+    }
+
+    //The valid records are sent, the stream stops at a broken one
+    int used = 0;
+    int count = 0;
+    bool broken = false;
+    while (used + (int)sizeof(Binlog::LogItem) <= len) {
+        Binlog::LogItem* item = (Binlog::LogItem*)(&m_buff[0] + used);
+        if (!item->hasValidHeader()) {
+            broken = true;
+            break;
+        }
+        if (used + item->item_size > len) {
+            break;
+        }
+        if (!item->isValid(len - used)) {
+            broken = true;
+            break;
+        }
+        used += item->item_size;
+        ++count;
+    }
+
+    //A single record larger than the batch
+    if (count == 0 && !broken) {
+        Binlog::LogItem* item = (Binlog::LogItem*)(&m_buff[0]);
+        if (len < (int)sizeof(Binlog::LogItem) || m_offset + item->item_size > size) {
+            Logger::log(Logger::Error, "ReplicaSender::readRecords: %s: truncated record at %lld",
+                        m_fileName.c_str(), m_offset);
+            return -1;
+        }
+        used = item->item_size;
+        count = 1;
+        m_buff.resize(used);
+        if (::pread(m_fd, &m_buff[0], used, m_offset) != used) {
+            Logger::log(Logger::Error, "ReplicaSender::readRecords: pread: %s", strerror(errno));
+            return -1;
+        }
+        broken = !((Binlog::LogItem*)(&m_buff[0]))->isValid(used);
+        if (broken) {
+            count = 0;
+        }
+    }
+    if (count == 0) {
+        Logger::log(Logger::Error, "ReplicaSender::readRecords: %s: invalid record at %lld",
+                    m_fileName.c_str(), m_offset);
+        return -1;
+    }
+
+    m_infoLock.lock();
+    m_offset += used;
+    m_infoLock.unlock();
+    *itemCount = count;
+    return used;
+#else
+    (void)itemCount;
+    return -1;
+#endif
+}
+
+void ReplicaSender::waitRecords(int msec)
+{
+    std::string path = m_cluster->binlogFileName(m_fileName);
+    m_cluster->lockCurrentBinlogFile();
+    Binlog* curBinlog = m_cluster->currentBinlog();
+    if (!m_stopped && curBinlog->fileName() == path &&
+            (long long)curBinlog->writtenSize() <= m_offset) {
+        m_cluster->waitBinlogAppended(msec);
+    }
+    m_cluster->unlockCurrentBinlogFile();
+}
+
+bool ReplicaSender::sendFrame(int type, const char* payload, int size, int itemCount)
+{
+    ReplFrame frame;
+    memset(&frame, 0, sizeof(frame));
+    frame.magic = ReplFrame::Magic;
+    frame.type = type;
+    frame.payloadSize = size;
+    frame.itemCount = itemCount;
+    frame.streamOffset = m_sentOffset + size;
+    frame.lastUpdateOffset = m_offset;
+    strncpy(frame.fileName, m_fileName.c_str(), sizeof(frame.fileName) - 1);
+
+    if (!sendAll((char*)&frame, sizeof(frame))) {
+        return false;
+    }
+    if (size > 0 && !sendAll(payload, size)) {
+        return false;
+    }
+    m_infoLock.lock();
+    m_sentOffset += size;
+    m_infoLock.unlock();
+    return true;
+}
+
+bool ReplicaSender::sendAll(const char* buff, int len)
+{
+    int sent = 0;
+    while (sent < len) {
+        int n = m_socket.send(buff + sent, len - sent, MSG_NOSIGNAL);
+        if (n <= 0) {
+            if (n < 0 && errno == EINTR) {
+                continue;
+            }
+            if (!m_stopped) {
+                Logger::log(Logger::Warning, "Replica %s:%d: send failed: %s",
+                            m_addr.ip(), m_addr.port(), strerror(errno));
+            }
+            return false;
+        }
+        sent += n;
+    }
+    return true;
+}
+
+bool ReplicaSender::readAcks(bool wait)
+{
+    char buff[1024];
+    while (true) {
+        int n = m_socket.recv(buff, sizeof(buff), wait ? 0 : MSG_DONTWAIT);
+        if (n == 0) {
+            return false;
+        }
+        if (n < 0) {
+            return (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR);
+        }
+
+        m_ackBuff.append(buff, n);
+        size_t pos = 0;
+        while (m_ackBuff.size() - pos >= sizeof(ReplAck)) {
+            ReplAck ack;
+            memcpy(&ack, m_ackBuff.data() + pos, sizeof(ack));
+            pos += sizeof(ack);
+            if (!ack.isValid()) {
+                Logger::log(Logger::Warning, "Replica %s:%d: invalid acknowledgement",
+                            m_addr.ip(), m_addr.port());
+                return false;
+            }
+            ack.fileName[sizeof(ack.fileName) - 1] = '\0';
+            m_infoLock.lock();
+            m_ackedOffset = ack.streamOffset;
+            m_ackedFileName = ack.fileName;
+            m_ackedPos = ack.lastUpdateOffset;
+            m_infoLock.unlock();
+            m_lastAckTime = currentMsec();
+        }
+        m_ackBuff.erase(0, pos);
+
+        if (wait) {
+            return true;
+        }
+    }
+}
+
+
+ReplicationMaster::ReplicationMaster(LeveldbCluster* cluster) :
+    m_cluster(cluster),
+    m_stopped(true)
+{
+}
+
+ReplicationMaster::~ReplicationMaster(void)
+{
+    stop();
+}
+
+bool ReplicationMaster::addReplica(const TcpSocket& sock, const HostAddress& addr,
+                                   const std::string& fileName, long long position, bool isRecordIndex)
+{
+#ifndef WIN32
+    socket_t fd = ::dup(sock.socket());
+    if (fd < 0) {
+        Logger::log(Logger::Error, "ReplicationMaster::addReplica: dup: %s", strerror(errno));
+        return false;
+    }
+
+    ReplicaSender* sender = new ReplicaSender(m_cluster, fd, addr);
+    std::string err;
+    if (!sender->locate(fileName, position, isRecordIndex, err)) {
+        Logger::log(Logger::Warning, "Replica %s:%d: %s (%s:%lld)",
+                    addr.ip(), addr.port(), err.c_str(), fileName.c_str(), position);
+        sender->sendError(err);
+        delete sender;
+        return false;
+    }
+
+    m_lock.lock();
+    if (m_stopped) {
+        m_lock.unlock();
+        delete sender;
+        return false;
+    }
+    reap(false);
+    m_senders.push_back(sender);
+    sender->start();
+    m_lock.unlock();
+    return true;
+#else
+    (void)sock;
+    (void)addr;
+    (void)fileName;
+    (void)position;
+    (void)isRecordIndex;
+    return false;
+#endif
+}
+
+void ReplicationMaster::replicas(std::vector<ReplicaInfo>& infos)
+{
+    m_lock.lock();
+    reap(false);
+    for (std::list<ReplicaSender*>::iterator it = m_senders.begin(); it != m_senders.end(); ++it) {
+        ReplicaInfo info;
+        (*it)->info(&info);
+        infos.push_back(info);
+    }
+    m_lock.unlock();
+}
+
+void ReplicationMaster::start(void)
+{
+    m_lock.lock();
+    m_stopped = false;
+    m_lock.unlock();
+}
+
+void ReplicationMaster::stop(void)
+{
+    m_lock.lock();
+    m_stopped = true;
+    for (std::list<ReplicaSender*>::iterator it = m_senders.begin(); it != m_senders.end(); ++it) {
+        (*it)->stop();
+    }
+    m_lock.unlock();
+
+    m_cluster->notifyBinlogWaiters();
+
+    m_lock.lock();
+    reap(true);
+    m_lock.unlock();
+}
+
+void ReplicationMaster::reap(bool all)
+{
+    std::list<ReplicaSender*>::iterator it = m_senders.begin();
+    while (it != m_senders.end()) {
+        ReplicaSender* sender = *it;
+        if (all || sender->isFinished()) {
+            sender->stop();
+            sender->join();
+            delete sender;
+            it = m_senders.erase(it);
+        } else {
+            ++it;
+        }
+    }
+}
@@ -0,0 +1,125 @@
+﻿/*
+* Licensed to the Apache Software Foundation (ASF) under one
+* or more contributor license agreements.  See the NOTICE file
+* distributed with this work for additional information
+* regarding copyright ownership.  The ASF licenses this file
+* to you under the Apache License, Version 2.0 (the
+* "License"); you may not use this file except in compliance
+* with the License.  You may obtain a copy of the License at
+*
+*   http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing,
+* software distributed under the License is distributed on an
+* "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+* KIND, either express or implied.  See the License for the
+* specific language governing permissions and limitations
+* under the License.
+*/
+
+#ifndef REPLICATION_H
+#define REPLICATION_H
+
+#include <string>
+#include <list>
+#include <vector>
+
+#include "util/locker.h"
+#include "util/tcpsocket.h"
+#include "leveldb.h"
+
+/*
+    Push-based binlog replication
+
+    A replica sends "__REPLSTREAM file pos" once, the master hands the
+    connection over to a sender thread. The sender streams the binlog
+    records after that position and then pushes every new record as soon
+    as it is appended. The replica acknowledges each frame after applying
+    it, the sender stops reading ahead while too many bytes are not
+    acknowledged yet.
+
+    A position is a binlog file name and the byte offset of the next record
+    in it. "__REPLSTREAM file pos RECORD" takes the record position of
+    __SYNC instead (the index of the last applied record), the handshake
+    frame then carries the matching byte offset.
+
+    Records are sent in the binlog format v2, the replica verifies their
+    checksums before applying them.
+*/
+
+struct ReplFrame {
+    enum { Magic = 0x5e91f4a4 };
+    enum Type {
+        Handshake = 1,          //first frame, carries the starting position
+        Records = 2,            //binlog records of one file
+        Heartbeat = 3,          //no new records, carries the current position
+        Error = 4               //fileName holds the error message
+    };
+    enum {
+        MaxPayloadSize = 512*1024*1024
+    };
+
+    int magic;
+    int type;
+    int payloadSize;            //size of the log items (format v2) following the frame
+    int itemCount;              //log item count
+    long long streamOffset;     //record bytes sent on this stream, this frame included
+    long long lastUpdateOffset; //offset in fileName after this frame
+    char fileName[128];         //binlog file name
+
+    bool isValid(void) const { return magic == Magic; }
+};
+
+struct ReplAck {
+    enum { Magic = 0x5e91ac4b };
+
+    int magic;
+    int reserved;
+    long long lastUpdateOffset; //offset in fileName after the last applied frame
+    long long streamOffset;     //streamOffset of the last applied frame
+    char fileName[128];
+
+    bool isValid(void) const { return magic == Magic; }
+};
+
+
+class ReplicaSender;
+class ReplicationMaster
+{
+public:
+    struct ReplicaInfo {
+        std::string address;
+        std::string sentFileName;
+        long long sentPos;
+        std::string ackedFileName;
+        long long ackedPos;
+        long long sentOffset;
+        long long ackedOffset;
+    };
+
+    ReplicationMaster(LeveldbCluster* cluster);
+    ~ReplicationMaster(void);
+
+    LeveldbCluster* leveldbCluster(void) { return m_cluster; }
+
+    //Stream the binlog to the replica connected on sock, the socket is duplicated
+    bool addReplica(const TcpSocket& sock, const HostAddress& addr,
+                    const std::string& fileName, long long position, bool isRecordIndex);
+    void replicas(std::vector<ReplicaInfo>& infos);
+
+    void start(void);
+    void stop(void);
+
+private:
+    void reap(bool all);
+
+private:
+    LeveldbCluster* m_cluster;
+    Mutex m_lock;
+    std::list<ReplicaSender*> m_senders;
+    bool m_stopped;
+    ReplicationMaster(const ReplicationMaster&);
+    ReplicationMaster& operator=(const ReplicationMaster&);
+};
+
+#endif
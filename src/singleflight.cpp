@@ -0,0 +1,109 @@
+﻿/*
+* Licensed to the Apache Software Foundation (ASF) under one
+* or more contributor license agreements.  See the NOTICE file
+* distributed with this work for additional information
+* regarding copyright ownership.  The ASF licenses this file
+* to you under the Apache License, Version 2.0 (the
+* "License"); you may not use this file except in compliance
+* with the License.  You may obtain a copy of the License at
+*
+*   http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing,
+* software distributed under the License is distributed on an
+* "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+* KIND, either express or implied.  See the License for the
+* specific language governing permissions and limitations
+* under the License.
+*/
+
+#include "singleflight.h"
+
+SingleFlight::SingleFlight(void)
+{
+    m_leaderReads = 0;
+    m_coalescedReads = 0;
+}
+
+SingleFlight::~SingleFlight(void)
+{
+}
+
+//Called with the shard locked
+void SingleFlight::release(Call* call)
+{
+    if (--call->refs == 0) {
+        delete call;
+    }
+}
+
+bool SingleFlight::begin(const XObject& key, Call** call)
+{
+    Shard* shard = shardOf(key);
+    std::string _key(key.data, key.len);
+
+    shard->lock.lock();
+    CallMap::iterator it = shard->calls.find(_key);
+    if (it != shard->calls.end()) {
+        *call = it->second;
+        (*call)->refs++;
+        shard->lock.unlock();
+        __sync_fetch_and_add(&m_coalescedReads, 1);
+        return false;
+    }
+
+    Call* c = new Call;
+    c->found = false;
+    c->done = false;
+    c->refs = 1;
+    shard->calls[_key] = c;
+    shard->lock.unlock();
+
+    __sync_fetch_and_add(&m_leaderReads, 1);
+    *call = c;
+    return true;
+}
+
+void SingleFlight::finish(const XObject& key, Call* call, bool found, const std::string& val)
+{
+    Shard* shard = shardOf(key);
+    shard->lock.lock();
+    call->found = found;
+    if (call->refs > 1) {
+        call->value = val;
+    }
+    call->done = true;
+
+    //The call may have been forgotten by a write
+    CallMap::iterator it = shard->calls.find(std::string(key.data, key.len));
+    if (it != shard->calls.end() && it->second == call) {
+        shard->calls.erase(it);
+    }
+    release(call);
+    shard->cond.broadcast();
+    shard->lock.unlock();
+}
+
+bool SingleFlight::wait(const XObject& key, Call* call, std::string& val)
+{
+    Shard* shard = shardOf(key);
+    shard->lock.lock();
+    while (!call->done) {
+        shard->cond.wait();
+    }
+    bool found = call->found;
+    if (found) {
+        val = call->value;
+    }
+    release(call);
+    shard->lock.unlock();
+    return found;
+}
+
+void SingleFlight::forget(const XObject& key)
+{
+    Shard* shard = shardOf(key);
+    shard->lock.lock();
+    shard->calls.erase(std::string(key.data, key.len));
+    shard->lock.unlock();
+}
@@ -0,0 +1,81 @@
+﻿/*
+* Licensed to the Apache Software Foundation (ASF) under one
+* or more contributor license agreements.  See the NOTICE file
+* distributed with this work for additional information
+* regarding copyright ownership.  The ASF licenses this file
+* to you under the Apache License, Version 2.0 (the
+* "License"); you may not use this file except in compliance
+* with the License.  You may obtain a copy of the License at
+*
+*   http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing,
+* software distributed under the License is distributed on an
+* "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+* KIND, either express or implied.  See the License for the
+* specific language governing permissions and limitations
+* under the License.
+*/
+
+#ifndef SINGLEFLIGHT_H
+#define SINGLEFLIGHT_H
+
+#include <string>
+#include <unordered_map>
+
+#include "util/locker.h"
+#include "leveldb.h"
+
+/*
+    Coalesce concurrent reads of the same key
+
+    The first reader of a key becomes the leader and reads the storage,
+    the readers arriving while it is in flight wait for its result
+    instead of issuing the same read. A write forgets the in-flight read
+    of its key, so a reader arriving after the write starts a new one.
+*/
+class SingleFlight
+{
+public:
+    struct Call {
+        std::string value;
+        bool found;
+        bool done;
+        int refs;
+    };
+
+    SingleFlight(void);
+    ~SingleFlight(void);
+
+    //Return true if the caller is the leader and must read the storage
+    bool begin(const XObject& key, Call** call);
+    void finish(const XObject& key, Call* call, bool found, const std::string& val);
+    bool wait(const XObject& key, Call* call, std::string& val);
+    void forget(const XObject& key);
+
+    unsigned long long leaderReads(void) const { return m_leaderReads; }
+    unsigned long long coalescedReads(void) const { return m_coalescedReads; }
+
+private:
+    enum { ShardCount = 64 };
+    typedef std::unordered_map<std::string, Call*> CallMap;
+    struct Shard {
+        Shard(void) : cond(&lock) {}
+        Mutex lock;
+        Condition cond;
+        CallMap calls;
+    };
+
+    Shard* shardOf(const XObject& key)
+    { return &m_shards[hashForBytes(key.data, key.len) % ShardCount]; }
+    void release(Call* call);
+
+private:
+    Shard m_shards[ShardCount];
+    unsigned long long m_leaderReads;
+    unsigned long long m_coalescedReads;
+    SingleFlight(const SingleFlight&);
+    SingleFlight& operator=(const SingleFlight&);
+};
+
+#endif
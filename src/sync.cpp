@@ -17,12 +17,18 @@
 * under the License.
 */
 
+#include <time.h>
+#include <errno.h>
+#include <string.h>
+
 #include "util/logger.h"
 #include "sync.h"
 #include "t_redis.h"
 #include "t_zset.h"
 #include "t_hash.h"
+#include "t_string.h"
 #include "ttlmanager.h"
+#include "replication.h"
 
 
 Sync::Sync(RedisProxy* proxy, const char* master, int port)
@@ -32,6 +38,9 @@ Sync::Sync(RedisProxy* proxy, const char* master, int port)
     m_proxy = proxy;
     m_masterAddr = HostAddress(master, port);
     m_slaveIndexFileName = "MASTER_INFO";
+    m_masterPos = 0;
+    m_positionIsOffset = true;
+    m_mode = Connecting;
 }
 
 Sync::~Sync()
@@ -52,6 +61,101 @@ void Sync::setReconnectInterval(int t)
 }
 
 
+void Sync::position(std::string& fileName, long long& pos, bool& isOffset)
+{
+    m_infoLock.lock();
+    fileName = m_masterFileName;
+    pos = m_masterPos;
+    isOffset = m_positionIsOffset;
+    m_infoLock.unlock();
+}
+
+bool Sync::setPosition(const char* fileName, long long pos, bool isOffset)
+{
+    m_infoLock.lock();
+    bool changed = (m_masterFileName != fileName ||
+                    m_masterPos != pos ||
+                    m_positionIsOffset != isOffset);
+    if (changed) {
+        m_masterFileName = fileName;
+        m_masterPos = pos;
+        m_positionIsOffset = isOffset;
+    }
+    m_infoLock.unlock();
+    return changed;
+}
+
+/*
+    MASTER_INFO holds "v2", the master binlog file name and the byte offset
+    of the next record. The old format has only the file name and the
+    index of the last applied record, it is converted by the first
+    streaming handshake.
+*/
+bool Sync::loadMasterInfo(void)
+{
+    std::vector<std::string> info;
+    if (!TextConfigFile::read(m_slaveIndexFileName, info)) {
+        setPosition(" ", 0, true);
+        return true;
+    }
+    if (info.size() == 3 && info[0] == "v2") {
+        setPosition(info[1].c_str(), atoll(info[2].c_str()), true);
+        return true;
+    }
+    if (info.size() == 2) {
+        setPosition(info[0].c_str(), atoi(info[1].c_str()), false);
+        return true;
+    }
+    Logger::log(Logger::Warning, "MASTER_INFO file invalid");
+    return false;
+}
+
+void Sync::saveMasterInfo(void)
+{
+    char posBuf[32] = {0};
+    sprintf(posBuf, "%lld", m_masterPos);
+
+    std::vector<std::string> info;
+    if (m_positionIsOffset) {
+        info.push_back("v2");
+    }
+    info.push_back(m_masterFileName);
+    info.push_back(posBuf);
+    TextConfigFile::write(m_slaveIndexFileName, info);
+}
+
+bool Sync::recvAll(char* buff, int len)
+{
+    int received = 0;
+    while (received < len) {
+        int n = m_socket.recv(buff + received, len - received);
+        if (n <= 0) {
+            if (n < 0 && errno == EINTR) {
+                continue;
+            }
+            return false;
+        }
+        received += n;
+    }
+    return true;
+}
+
+bool Sync::sendAll(const char* buff, int len)
+{
+    int sent = 0;
+    while (sent < len) {
+        int n = m_socket.send(buff + sent, len - sent, MSG_NOSIGNAL);
+        if (n <= 0) {
+            if (n < 0 && errno == EINTR) {
+                continue;
+            }
+            return false;
+        }
+        sent += n;
+    }
+    return true;
+}
+
 void Sync::repairConnect(void)
 {
     m_socket.close();
@@ -71,12 +175,8 @@ void Sync::repairConnect(void)
 
 
 
-bool Sync::_onSetCommand(Binlog::LogItem* item, LeveldbCluster* db)
+bool Sync::_onSetCommand(char* key, int keySize, char* value, int valueSize, LeveldbCluster* db)
 {
-    char* key = item->keyBuffer();
-    int keySize = item->key_size;
-    char* value = item->valueBuffer();
-    int valueSize = item->value_size;
     short type = *((short*)key);
     switch (type) {
     case T_KV:
@@ -93,16 +193,21 @@ bool Sync::_onSetCommand(Binlog::LogItem* item, LeveldbCluster* db)
         op.mapping_key = XObject(info.name.data, info.name.len);
         return db->setValue(XObject(key, keySize), XObject(value, valueSize), op);
     }
+    case T_StringChunk: {
+        std::string mapping;
+        TString::chunkMappingKey(key, keySize, mapping);
+        LeveldbCluster::WriteOption op;
+        op.mapping_key = XObject(mapping.data(), mapping.size());
+        return db->setValue(XObject(key, keySize), XObject(value, valueSize), op);
+    }
 
     default:
         return false;
     }
 }
 
-bool Sync::_onDelCommand(Binlog::LogItem* item, LeveldbCluster* db)
+bool Sync::_onDelCommand(char* key, int keySize, LeveldbCluster* db)
 {
-    char* key = item->keyBuffer();
-    int keySize = item->key_size;
     short type = *((short*)key);
 
     switch (type) {
@@ -120,6 +225,13 @@ bool Sync::_onDelCommand(Binlog::LogItem* item, LeveldbCluster* db)
         op.mapping_key = XObject(info.name.data, info.name.len);
         return db->remove(XObject(key, keySize), op);
     }
+    case T_StringChunk: {
+        std::string mapping;
+        TString::chunkMappingKey(key, keySize, mapping);
+        LeveldbCluster::WriteOption op;
+        op.mapping_key = XObject(mapping.data(), mapping.size());
+        return db->remove(XObject(key, keySize), op);
+    }
 
     default:
         return false;
@@ -129,17 +241,8 @@ bool Sync::_onDelCommand(Binlog::LogItem* item, LeveldbCluster* db)
 
 void Sync::run(void)
 {
-    m_masterSyncInfo.clear();
-    bool ok = TextConfigFile::read(m_slaveIndexFileName, m_masterSyncInfo);
-    if (ok) {
-        if (m_masterSyncInfo.size() != 2)  {
-            Logger::log(Logger::Warning, "MASTER_INFO file invalid");
-            return;
-        }
-    } else {
-        m_masterSyncInfo.clear();
-        m_masterSyncInfo.push_back(" ");
-        m_masterSyncInfo.push_back("-1");
+    if (!loadMasterInfo()) {
+        return;
     }
     m_socket = TcpSocket::createTcpSocket();
 
@@ -149,13 +252,30 @@ void Sync::run(void)
         return;
     }
 
+    if (runStream()) {
+        return;
+    }
+
+    Logger::log(Logger::Message, "master (%s:%d) does not support streaming, polling with __SYNC",
+                m_masterAddr.ip(), m_masterAddr.port());
+    if (m_positionIsOffset) {
+        if (m_masterFileName[0] != ' ') {
+            Logger::log(Logger::Error, "MASTER_INFO holds a byte offset the master does not "
+                        "understand, sync thread stopped");
+            return;
+        }
+        setPosition(" ", -1, false);
+    }
+    m_mode = Polling;
     char sendBuf[256];
     memset(sendBuf, '\0', sizeof(sendBuf));
 
     while (true) {
+        char posBuf[32] = {0};
+        sprintf(posBuf, "%lld", m_masterPos);
         int sendLenth = sprintf(sendBuf,"*3\r\n$6\r\n__SYNC\r\n$%d\r\n%s\r\n$%d\r\n%s\r\n",
-                                (int)m_masterSyncInfo[0].length(), m_masterSyncInfo[0].c_str(),
-                (int)m_masterSyncInfo[1].length(), m_masterSyncInfo[1].c_str());
+                                (int)m_masterFileName.length(), m_masterFileName.c_str(),
+                (int)strlen(posBuf), posBuf);
         int sendBytes = m_socket.send(sendBuf, sendLenth);
         if (sendBytes < 0) {
             repairConnect();
@@ -210,33 +330,166 @@ void Sync::run(void)
                         stream->error, stream->errorMsg);
             return;
         }
-        char posBuf[20] = {0};
-        sprintf(posBuf, "%d", stream->lastUpdatePos);
-
-        m_masterSyncInfo.clear();
-        m_masterSyncInfo.push_back(stream->srcFileName);
-        m_masterSyncInfo.push_back(posBuf);
-        TextConfigFile::write(m_slaveIndexFileName, m_masterSyncInfo);
+        setPosition(stream->srcFileName, stream->lastUpdatePos, false);
+        saveMasterInfo();
 
         int i = 0;
-        for (Binlog::LogItem* item = stream->firstLogItem();
+        for (Binlog::LegacyLogItem* item = stream->firstLogItem();
              i < stream->logItemCount; item = stream->nextLogItem(item), ++i)
         {
-            LeveldbCluster* db = m_proxy->leveldbCluster();
-            switch (item->type)
-            {
-            case Binlog::LogItem::SET:
-                _onSetCommand(item, db);
+            applyLogItem(item->type, item->keyBuffer(), item->key_size,
+                         item->valueBuffer(), item->value_size);
+        }
+
+        Thread::sleep(m_syncInterval);
+    }
+}
+
+void Sync::applyLogItem(int type, char* key, int keySize, char* value, int valueSize)
+{
+    LeveldbCluster* db = m_proxy->leveldbCluster();
+    switch (type)
+    {
+    case Binlog::LogItem::SET:
+        _onSetCommand(key, keySize, value, valueSize, db);
+        break;
+    case Binlog::LogItem::DEL:
+        _onDelCommand(key, keySize, db);
+        break;
+    default:
+        break;
+    }
+}
+
+bool Sync::applyLogItems(char* buff, int size, int count)
+{
+    int used = 0;
+    for (int i = 0; i < count; ++i) {
+        if (used + (int)sizeof(Binlog::LogItem) > size) {
+            return false;
+        }
+        Binlog::LogItem* item = (Binlog::LogItem*)(buff + used);
+        if (!item->isValid(size - used)) {
+            return false;
+        }
+        applyLogItem(item->type, item->keyBuffer(), item->key_size,
+                     item->valueBuffer(), item->value_size);
+        used += item->item_size;
+    }
+    return true;
+}
+
+int Sync::requestStream(void)
+{
+    char posBuf[32] = {0};
+    sprintf(posBuf, "%lld", m_masterPos);
+
+    //A record position is converted to a byte offset by the master
+    char sendBuf[256];
+    int sendLength = sprintf(sendBuf, "*%d\r\n$12\r\n__REPLSTREAM\r\n$%d\r\n%s\r\n$%d\r\n%s\r\n%s",
+                             m_positionIsOffset ? 3 : 4,
+                             (int)m_masterFileName.length(), m_masterFileName.c_str(),
+                             (int)strlen(posBuf), posBuf,
+                             m_positionIsOffset ? "" : "$6\r\nRECORD\r\n");
+    if (!sendAll(sendBuf, sendLength)) {
+        return StreamBroken;
+    }
+
+    //An old master replies an error for the unknown command
+    char ch;
+    if (m_socket.recv(&ch, 1, MSG_PEEK) != 1) {
+        return StreamBroken;
+    }
+    if (ch == '-') {
+        while (m_socket.recv(&ch, 1) == 1 && ch != '\n') {}
+        return StreamUnsupported;
+    }
+    return StreamStarted;
+}
+
+/* Return false if the master does not support streaming */
+bool Sync::runStream(void)
+{
+    std::string payload;
+    time_t lastSaveTime = 0;
+    bool reconnect = false;
+    while (true) {
+        if (reconnect) {
+            m_mode = Connecting;
+            repairConnect();
+        }
+        reconnect = true;
+        m_socket.setRecvTimeout(RECVTIMEOUT);
+
+        switch (requestStream()) {
+        case StreamUnsupported:
+            m_socket.setRecvTimeout(0);
+            return false;
+        case StreamBroken:
+            continue;
+        default:
+            break;
+        }
+
+        while (true) {
+            ReplFrame frame;
+            if (!recvAll((char*)&frame, sizeof(frame))) {
                 break;
-            case Binlog::LogItem::DEL:
-                _onDelCommand(item, db);
+            }
+            if (!frame.isValid() || frame.payloadSize < 0 ||
+                    frame.payloadSize > ReplFrame::MaxPayloadSize) {
+                Logger::log(Logger::Error, "invalid replication frame from master");
+                break;
+            }
+            frame.fileName[sizeof(frame.fileName) - 1] = '\0';
+            if (frame.type == ReplFrame::Error) {
+                Logger::log(Logger::Error, "ERROR(%s) sync thread stopped", frame.fileName);
+                return true;
+            }
+
+            if (frame.payloadSize > 0) {
+                payload.resize(frame.payloadSize);
+                if (!recvAll(&payload[0], frame.payloadSize)) {
+                    break;
+                }
+            }
+            if (frame.type == ReplFrame::Handshake) {
+                Logger::log(Logger::Message, "streaming from master (%s:%d) at %s:%lld",
+                            m_masterAddr.ip(), m_masterAddr.port(),
+                            frame.fileName, frame.lastUpdateOffset);
+                if (!m_positionIsOffset) {
+                    Logger::log(Logger::Message, "MASTER_INFO converted to byte offsets");
+                }
+                m_mode = Streaming;
+            }
+            if (frame.type == ReplFrame::Records &&
+                    !applyLogItems(&payload[0], frame.payloadSize, frame.itemCount)) {
+                Logger::log(Logger::Error, "invalid binlog records from master");
                 break;
-            default:
+            }
+
+            //MASTER_INFO is saved after applying, at most once a second while records flow
+            bool changed = setPosition(frame.fileName, frame.lastUpdateOffset, true);
+            time_t now = time(NULL);
+            if (changed && (frame.type != ReplFrame::Records || now != lastSaveTime)) {
+                saveMasterInfo();
+                lastSaveTime = now;
+            }
+
+            ReplAck ack;
+            memset(&ack, 0, sizeof(ack));
+            ack.magic = ReplAck::Magic;
+            ack.lastUpdateOffset = frame.lastUpdateOffset;
+            ack.streamOffset = frame.streamOffset;
+            strcpy(ack.fileName, frame.fileName);
+            if (!sendAll((char*)&ack, sizeof(ack))) {
                 break;
             }
         }
 
-        Thread::sleep(m_syncInterval);
+        Logger::log(Logger::Warning, "replication stream from master (%s:%d) broken",
+                    m_masterAddr.ip(), m_masterAddr.port());
+        saveMasterInfo();
     }
 }
 
@@ -32,15 +32,40 @@ class Sync : public Thread
 {
 public:
     #define RECVTIMEOUT 5000
+    enum Mode {
+        Connecting = 0,
+        Streaming = 1,      //binlog records pushed by the master (__REPLSTREAM)
+        Polling = 2         //the master does not support streaming, poll with __SYNC
+    };
+
     Sync(RedisProxy* proxy, const char* master, int port);
     ~Sync();
     void setSyncInterval(int t);
     void setReconnectInterval(int t);
+
+    const HostAddress& masterAddress(void) const { return m_masterAddr; }
+    int mode(void) const { return m_mode; }
+    //pos is a byte offset, or a record index if isOffset is false (old MASTER_INFO)
+    void position(std::string& fileName, long long& pos, bool& isOffset);
 protected:
     virtual void run(void);
 private:
-    bool _onSetCommand(Binlog::LogItem* item, LeveldbCluster* db);
-    bool _onDelCommand(Binlog::LogItem* item, LeveldbCluster* db);
+    enum {
+        StreamStarted,
+        StreamUnsupported,
+        StreamBroken
+    };
+    bool runStream(void);
+    int requestStream(void);
+    bool applyLogItems(char* buff, int size, int count);
+    void applyLogItem(int type, char* key, int keySize, char* value, int valueSize);
+    bool loadMasterInfo(void);
+    void saveMasterInfo(void);
+    bool setPosition(const char* fileName, long long pos, bool isOffset);
+    bool recvAll(char* buff, int len);
+    bool sendAll(const char* buff, int len);
+    bool _onSetCommand(char* key, int keySize, char* value, int valueSize, LeveldbCluster* db);
+    bool _onDelCommand(char* key, int keySize, LeveldbCluster* db);
     void repairConnect(void);
 private:
     int                      m_syncInterval;
@@ -51,7 +76,11 @@ private:
     RedisProxy*              m_proxy;
 
     string                   m_slaveIndexFileName;
-    std::vector<std::string> m_masterSyncInfo;
+    std::string              m_masterFileName;
+    long long                m_masterPos;
+    bool                     m_positionIsOffset;
+    Mutex                    m_infoLock;
+    volatile int             m_mode;
 private:
     Sync(const Sync&);
     Sync& operator =(const Sync& rhs);
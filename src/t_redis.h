@@ -32,7 +32,8 @@ enum {
     T_Set,
     T_ZSet,
     T_Hash,
-    T_Ttl
+    T_Ttl,
+    T_StringChunk
 };
 
 typedef std::list<std::string> stringlist;
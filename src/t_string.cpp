@@ -0,0 +1,369 @@
+﻿/*
+* Licensed to the Apache Software Foundation (ASF) under one
+* or more contributor license agreements.  See the NOTICE file
+* distributed with this work for additional information
+* regarding copyright ownership.  The ASF licenses this file
+* to you under the Apache License, Version 2.0 (the
+* "License"); you may not use this file except in compliance
+* with the License.  You may obtain a copy of the License at
+*
+*   http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing,
+* software distributed under the License is distributed on an
+* "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+* KIND, either express or implied.  See the License for the
+* specific language governing permissions and limitations
+* under the License.
+*/
+
+#include <string.h>
+#include <stddef.h>
+
+#include "t_string.h"
+
+static TString::Option s_option;
+
+static unsigned int headerChecksum(const StringHeader* header)
+{
+    return hashForBytes((const char*)header, offsetof(StringHeader, checksum));
+}
+
+TString::TString(LeveldbCluster* db, const XObject& key) :
+    m_db(db),
+    m_key(key.data, key.len),
+    m_loaded(false),
+    m_exists(false),
+    m_chunked(false)
+{
+    memset(&m_header, 0, sizeof(m_header));
+    m_wopt.mapping_key = XObject(m_key.data(), m_key.size());
+    m_ropt.mapping_key = XObject(m_key.data(), m_key.size());
+}
+
+TString::~TString(void)
+{
+}
+
+void TString::setOption(const Option& opt)
+{
+    s_option = opt;
+}
+
+const TString::Option& TString::option(void)
+{
+    return s_option;
+}
+
+bool TString::isHeader(const char* data, int len)
+{
+    if (len != (int)sizeof(StringHeader)) {
+        return false;
+    }
+    StringHeader header;
+    memcpy(&header, data, sizeof(header));
+    return header.magic == StringHeader::_magic
+            && header.chunkSize > 0
+            && header.checksum == headerChecksum(&header);
+}
+
+void TString::chunkMappingKey(const char* chunkKey, int len, std::string& mapping)
+{
+    short type = T_KV;
+    mapping.append((char*)&type, sizeof(type));
+    mapping.append(chunkKey + sizeof(StringChunkKey), len - sizeof(StringChunkKey));
+}
+
+bool TString::load(void)
+{
+    if (m_loaded) {
+        return m_exists;
+    }
+    m_loaded = true;
+    m_chunked = false;
+    m_value.clear();
+
+    std::string raw;
+    m_exists = m_db->value(XObject(m_key.data(), m_key.size()), raw);
+    if (m_exists && isHeader(raw)) {
+        memcpy(&m_header, raw.data(), sizeof(m_header));
+        m_chunked = true;
+    } else {
+        m_value.swap(raw);
+    }
+    return m_exists;
+}
+
+void TString::readChunk(int index, std::string& chunk)
+{
+    std::string buf;
+    StringChunkKey::makeStringChunkKey(m_key.data() + sizeof(short), m_key.size() - sizeof(short), index, buf);
+    chunk.clear();
+    m_db->value(XObject(buf.data(), buf.size()), chunk, m_ropt);
+}
+
+bool TString::writeChunk(int index, const char* data, int len)
+{
+    std::string buf;
+    StringChunkKey::makeStringChunkKey(m_key.data() + sizeof(short), m_key.size() - sizeof(short), index, buf);
+    return m_db->setValue(XObject(buf.data(), buf.size()), XObject(data, len), m_wopt);
+}
+
+void TString::removeChunks(int from, int to)
+{
+    for (int i = from; i < to; ++i) {
+        std::string buf;
+        StringChunkKey::makeStringChunkKey(m_key.data() + sizeof(short), m_key.size() - sizeof(short), i, buf);
+        m_db->remove(XObject(buf.data(), buf.size()), m_wopt);
+    }
+}
+
+bool TString::writeHeader(long long length, int chunkSize)
+{
+    memset(&m_header, 0, sizeof(m_header));
+    m_header.magic = StringHeader::_magic;
+    m_header.chunkSize = chunkSize;
+    m_header.length = length;
+    m_header.checksum = headerChecksum(&m_header);
+
+    bool ok = m_db->setValue(XObject(m_key.data(), m_key.size()),
+                             XObject((char*)&m_header, sizeof(m_header)));
+    if (ok) {
+        m_loaded = true;
+        m_exists = true;
+        m_chunked = true;
+        m_value.clear();
+    }
+    return ok;
+}
+
+//The chunks are written before the header, a reader never sees a header without its chunks
+bool TString::setChunked(const char* data, long long len)
+{
+    int oldCount = m_chunked ? m_header.chunkCount() : 0;
+    int chunkSize = s_option.chunkSize;
+    int index = 0;
+    for (long long pos = 0; pos < len; pos += chunkSize, ++index) {
+        int n = (len - pos) < chunkSize ? (int)(len - pos) : chunkSize;
+        if (!writeChunk(index, data + pos, n)) {
+            return false;
+        }
+    }
+    if (!writeHeader(len, chunkSize)) {
+        return false;
+    }
+    removeChunks(index, oldCount);
+    return true;
+}
+
+template <typename Output>
+void TString::readRange(long long start, long long len, Output* out)
+{
+    int chunkSize = m_header.chunkSize;
+    std::string chunk;
+    while (len > 0) {
+        int index = (int)(start / chunkSize);
+        int offset = (int)(start % chunkSize);
+        int n = (chunkSize - offset) < len ? (chunkSize - offset) : (int)len;
+        readChunk(index, chunk);
+
+        //A missing or short chunk reads as zeros (SETRANGE beyond the end)
+        int avail = (int)chunk.size() - offset;
+        if (avail < 0) {
+            avail = 0;
+        }
+        if (avail > n) {
+            avail = n;
+        }
+        if (avail > 0) {
+            out->append(chunk.data() + offset, avail);
+        }
+        if (avail < n) {
+            std::string zeros(n - avail, '\0');
+            out->append(zeros.data(), zeros.size());
+        }
+        start += n;
+        len -= n;
+    }
+}
+
+bool TString::exists(void)
+{
+    return load();
+}
+
+long long TString::length(void)
+{
+    if (!load()) {
+        return 0;
+    }
+    return m_chunked ? m_header.length : (long long)m_value.size();
+}
+
+bool TString::get(std::string& val)
+{
+    if (!load()) {
+        return false;
+    }
+    if (!m_chunked) {
+        val = m_value;
+        return true;
+    }
+    val.clear();
+    val.reserve(m_header.length);
+    readRange(0, m_header.length, &val);
+    return true;
+}
+
+bool TString::get(IOBuffer* buff)
+{
+    if (!load()) {
+        return false;
+    }
+    if (!m_chunked) {
+        buff->append(m_value.data(), m_value.size());
+        return true;
+    }
+    readRange(0, m_header.length, buff);
+    return true;
+}
+
+bool TString::getRange(long long start, long long stop, std::string& val)
+{
+    val.clear();
+    if (!load()) {
+        return false;
+    }
+    long long len = length();
+    if (start < 0 || stop >= len || start > stop) {
+        return true;
+    }
+    if (!m_chunked) {
+        val.assign(m_value, start, stop - start + 1);
+        return true;
+    }
+    readRange(start, stop - start + 1, &val);
+    return true;
+}
+
+bool TString::set(const XObject& val)
+{
+    load();
+    if (s_option.enabled && val.len >= s_option.threshold) {
+        return setChunked(val.data, val.len);
+    }
+
+    int oldCount = m_chunked ? m_header.chunkCount() : 0;
+    if (!m_db->setValue(XObject(m_key.data(), m_key.size()), val)) {
+        return false;
+    }
+    removeChunks(0, oldCount);
+    m_loaded = false;
+    return true;
+}
+
+long long TString::append(const XObject& val)
+{
+    load();
+    if (!m_chunked) {
+        m_value.append(val.data, val.len);
+        if (s_option.enabled && (long long)m_value.size() >= s_option.threshold) {
+            setChunked(m_value.data(), m_value.size());
+            return m_header.length;
+        }
+        m_db->setValue(XObject(m_key.data(), m_key.size()), XObject(m_value.data(), m_value.size()));
+        m_exists = true;
+        return m_value.size();
+    }
+
+    //Only the tail chunk and the new chunks are written
+    int chunkSize = m_header.chunkSize;
+    long long pos = m_header.length;
+    const char* data = val.data;
+    int remain = val.len;
+    int index = (int)(pos / chunkSize);
+    int offset = (int)(pos % chunkSize);
+    if (offset > 0 && remain > 0) {
+        std::string chunk;
+        readChunk(index, chunk);
+        chunk.resize(offset, '\0');
+        int n = (chunkSize - offset) < remain ? (chunkSize - offset) : remain;
+        chunk.append(data, n);
+        writeChunk(index, chunk.data(), chunk.size());
+        data += n;
+        remain -= n;
+        ++index;
+    }
+    while (remain > 0) {
+        int n = chunkSize < remain ? chunkSize : remain;
+        writeChunk(index, data, n);
+        data += n;
+        remain -= n;
+        ++index;
+    }
+    writeHeader(pos + val.len, chunkSize);
+    return m_header.length;
+}
+
+long long TString::setRange(long long offset, const XObject& val)
+{
+    load();
+    long long curLen = length();
+    if (val.len == 0) {
+        return curLen;
+    }
+    long long newLen = (offset + val.len) > curLen ? (offset + val.len) : curLen;
+
+    if (!m_chunked) {
+        if (!(s_option.enabled && newLen >= s_option.threshold)) {
+            m_value.resize(newLen, '\0');
+            memcpy(&m_value[offset], val.data, val.len);
+            m_db->setValue(XObject(m_key.data(), m_key.size()), XObject(m_value.data(), m_value.size()));
+            m_exists = true;
+            return newLen;
+        }
+        //Convert to chunks, the range is written below
+        if (!setChunked(m_value.data(), m_value.size())) {
+            return curLen;
+        }
+    }
+
+    //Read-modify-write the chunks covering the range only
+    int chunkSize = m_header.chunkSize;
+    const char* data = val.data;
+    long long pos = offset;
+    int remain = val.len;
+    std::string chunk;
+    while (remain > 0) {
+        int index = (int)(pos / chunkSize);
+        int off = (int)(pos % chunkSize);
+        int n = (chunkSize - off) < remain ? (chunkSize - off) : remain;
+        if (off == 0 && n == chunkSize) {
+            writeChunk(index, data, n);
+        } else {
+            readChunk(index, chunk);
+            if ((int)chunk.size() < off + n) {
+                chunk.resize(off + n, '\0');
+            }
+            memcpy(&chunk[off], data, n);
+            writeChunk(index, chunk.data(), chunk.size());
+        }
+        data += n;
+        pos += n;
+        remain -= n;
+    }
+    writeHeader(newLen, chunkSize);
+    return newLen;
+}
+
+bool TString::remove(void)
+{
+    if (!load()) {
+        return false;
+    }
+    int count = m_chunked ? m_header.chunkCount() : 0;
+    m_db->remove(XObject(m_key.data(), m_key.size()));
+    removeChunks(0, count);
+    m_loaded = false;
+    return true;
+}
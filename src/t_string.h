@@ -0,0 +1,132 @@
+﻿/*
+* Licensed to the Apache Software Foundation (ASF) under one
+* or more contributor license agreements.  See the NOTICE file
+* distributed with this work for additional information
+* regarding copyright ownership.  The ASF licenses this file
+* to you under the Apache License, Version 2.0 (the
+* "License"); you may not use this file except in compliance
+* with the License.  You may obtain a copy of the License at
+*
+*   http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing,
+* software distributed under the License is distributed on an
+* "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+* KIND, either express or implied.  See the License for the
+* specific language governing permissions and limitations
+* under the License.
+*/
+
+#ifndef T_STRING_H
+#define T_STRING_H
+
+#include "util/iobuffer.h"
+#include "t_redis.h"
+#include "leveldb.h"
+
+/*
+    Strings above the chunk threshold are stored as fixed-size chunk keys,
+    the string key itself only keeps a StringHeader. APPEND, GETRANGE and
+    SETRANGE only touch the chunks covering the range.
+
+    The chunks are mapped by the string key, so they live in the same
+    database as their header.
+*/
+struct StringHeader
+{
+    enum { _magic = 0x57c4a11e };
+    int magic;
+    int chunkSize;
+    long long length;
+    unsigned int checksum;          //checksum of the fields above
+
+    int chunkCount(void) const
+    { return (int)((length + chunkSize - 1) / chunkSize); }
+};
+
+struct StringChunkKey
+{
+    short type;
+    short reserved;
+    int index;
+
+    char* namebuff(void) const { return (char*)(this+1); }
+
+    static void makeStringChunkKey(const char* name, int namelen, int index, std::string& s)
+    {
+        StringChunkKey key;
+        key.type = T_StringChunk;
+        key.reserved = 0;
+        key.index = index;
+        s.append((char*)&key, sizeof(key));
+        s.append(name, namelen);
+    }
+};
+
+class TString
+{
+public:
+    struct Option {
+        bool enabled;
+        int threshold;
+        int chunkSize;
+
+        Option(void) {
+            enabled = false;
+            threshold = 1024 * 1024;
+            chunkSize = 64 * 1024;
+        }
+    };
+
+    //key: the T_KV key of the string
+    TString(LeveldbCluster* db, const XObject& key);
+    ~TString(void);
+
+    static void setOption(const Option& opt);
+    static const Option& option(void);
+
+    bool exists(void);
+    long long length(void);
+    bool get(std::string& val);
+    //Append the whole value to buff chunk by chunk
+    bool get(IOBuffer* buff);
+    bool getRange(long long start, long long stop, std::string& val);
+    bool set(const XObject& val);
+    long long append(const XObject& val);
+    long long setRange(long long offset, const XObject& val);
+    bool remove(void);
+
+    static bool isStringKey(const XObject& key)
+    { return key.len >= (int)sizeof(short) && *((short*)key.data) == T_KV; }
+    static bool isHeader(const char* data, int len);
+    static bool isHeader(const std::string& val)
+    { return isHeader(val.data(), val.size()); }
+    //The chunk keys are mapped by the string key
+    static void chunkMappingKey(const char* chunkKey, int len, std::string& mapping);
+
+private:
+    bool load(void);
+    bool isChunked(void) const { return m_chunked; }
+    void readChunk(int index, std::string& chunk);
+    bool writeChunk(int index, const char* data, int len);
+    void removeChunks(int from, int to);
+    bool writeHeader(long long length, int chunkSize);
+    bool setChunked(const char* data, long long len);
+    template <typename Output>
+    void readRange(long long start, long long len, Output* out);
+
+private:
+    LeveldbCluster* m_db;
+    std::string m_key;
+    bool m_loaded;
+    bool m_exists;
+    bool m_chunked;
+    StringHeader m_header;
+    std::string m_value;            //the value when not chunked
+    LeveldbCluster::WriteOption m_wopt;
+    LeveldbCluster::ReadOption m_ropt;
+    TString(const TString&);
+    TString& operator=(const TString&);
+};
+
+#endif
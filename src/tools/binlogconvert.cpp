@@ -0,0 +1,172 @@
+﻿/*
+* Licensed to the Apache Software Foundation (ASF) under one
+* or more contributor license agreements.  See the NOTICE file
+* distributed with this work for additional information
+* regarding copyright ownership.  The ASF licenses this file
+* to you under the Apache License, Version 2.0 (the
+* "License"); you may not use this file except in compliance
+* with the License.  You may obtain a copy of the License at
+*
+*   http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing,
+* software distributed under the License is distributed on an
+* "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+* KIND, either express or implied.  See the License for the
+* specific language governing permissions and limitations
+* under the License.
+*/
+
+/*
+    onevalue-binlog-convert: rewrite the binlog files of a stopped server
+    in the format v2
+
+    Usage: onevalue-binlog-convert <work_dir>/binlog
+
+    The files are converted in the order of BINLOG_INDEX, the sequence
+    numbers continue across them. Records of a v1 file get the file
+    modification time as timestamp, a torn tail is dropped. Files already
+    in the format v2 are kept.
+*/
+
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include <string>
+#include <vector>
+
+#include "binlog.h"
+
+static bool convertFile(const std::string& path, long long* seq)
+{
+    FILE* in = fopen(path.c_str(), "rb");
+    if (!in) {
+        fprintf(stderr, "%s: %s\n", path.c_str(), strerror(errno));
+        return false;
+    }
+    Binlog::Header header;
+    if (fread(&header, sizeof(header), 1, in) != 1) {
+        fprintf(stderr, "%s: read header failed\n", path.c_str());
+        fclose(in);
+        return false;
+    }
+    if (header.isValid()) {
+        fclose(in);
+        BinlogIndex index;
+        if (!BinlogIndex::build(&index, path)) {
+            return false;
+        }
+        if (index.lastSeq() > *seq) {
+            *seq = index.lastSeq();
+        }
+        printf("%s: format v2, %d records, last seq %lld\n", path.c_str(), index.recordCount(), index.lastSeq());
+        return true;
+    }
+    if (!header.isV1()) {
+        fprintf(stderr, "%s: not a binlog file\n", path.c_str());
+        fclose(in);
+        return false;
+    }
+
+    struct stat sbuf;
+    if (fstat(fileno(in), &sbuf) != 0) {
+        fprintf(stderr, "%s: %s\n", path.c_str(), strerror(errno));
+        fclose(in);
+        return false;
+    }
+
+    std::string tmpPath = path + ".v2";
+    FILE* out = fopen(tmpPath.c_str(), "wb");
+    if (!out) {
+        fprintf(stderr, "%s: %s\n", tmpPath.c_str(), strerror(errno));
+        fclose(in);
+        return false;
+    }
+
+    header.handshake = Binlog::Header::_handshake;
+    bool ok = (fwrite(&header, sizeof(header), 1, out) == 1);
+    long long firstSeq = *seq + 1;
+    long long offset = sizeof(header);
+    int count = 0;
+    std::vector<char> buff;
+    while (ok) {
+        Binlog::LegacyLogItem legacyItem;
+        if (fread(&legacyItem, sizeof(legacyItem), 1, in) != 1) {
+            break;
+        }
+        if (legacyItem.key_size < 0 || legacyItem.value_size < 0 ||
+                (long long)sizeof(legacyItem) + legacyItem.key_size + legacyItem.value_size != legacyItem.item_size ||
+                (legacyItem.type != Binlog::LogItem::SET && legacyItem.type != Binlog::LogItem::DEL)) {
+            break;
+        }
+
+        int payloadSize = legacyItem.key_size + legacyItem.value_size;
+        buff.resize(sizeof(Binlog::LogItem) + payloadSize);
+        Binlog::LogItem* item = (Binlog::LogItem*)(&buff[0]);
+        if (payloadSize > 0 && fread(item->keyBuffer(), payloadSize, 1, in) != 1) {
+            break;
+        }
+        item->item_size = (int)buff.size();
+        item->type = legacyItem.type;
+        item->key_size = legacyItem.key_size;
+        item->value_size = legacyItem.value_size;
+        item->timestamp = (unsigned int)sbuf.st_mtime;
+        item->seal(++*seq, item->payloadChecksum());
+        ok = (fwrite(&buff[0], buff.size(), 1, out) == 1);
+        offset += legacyItem.item_size;
+        ++count;
+    }
+    fclose(in);
+
+    if (ok && fflush(out) != 0) {
+        ok = false;
+    }
+    if (ok && fsync(fileno(out)) != 0) {
+        ok = false;
+    }
+    if (fclose(out) != 0) {
+        ok = false;
+    }
+    if (!ok || rename(tmpPath.c_str(), path.c_str()) != 0) {
+        fprintf(stderr, "%s: write failed: %s\n", tmpPath.c_str(), strerror(errno));
+        remove(tmpPath.c_str());
+        return false;
+    }
+    std::string indexFile = path + ".idx";
+    remove(indexFile.c_str());
+
+    printf("%s: converted %d records, seq %lld-%lld", path.c_str(), count, firstSeq, *seq);
+    if (offset < sbuf.st_size) {
+        printf(", dropped %lld bytes of a broken tail at %lld", (long long)sbuf.st_size - offset, offset);
+    }
+    printf("\n");
+    return true;
+}
+
+int main(int argc, char** argv)
+{
+    if (argc != 2) {
+        fprintf(stderr, "Usage: %s <work_dir>/binlog\n"
+                "Convert the binlog files of a stopped server to the format v2\n", argv[0]);
+        return 1;
+    }
+
+    std::string dir = argv[1];
+    BinlogFileList flist;
+    BinlogFileList::loadFromFile(&flist, dir + "/BINLOG_INDEX");
+    if (flist.isEmpty()) {
+        fprintf(stderr, "%s/BINLOG_INDEX: no binlog file\n", dir.c_str());
+        return 1;
+    }
+
+    long long seq = 0;
+    for (int i = 0; i < flist.fileCount(); ++i) {
+        if (!convertFile(dir + "/" + flist.fileName(i), &seq)) {
+            return 1;
+        }
+    }
+    return 0;
+}
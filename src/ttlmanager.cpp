@@ -21,6 +21,7 @@
 #include <stdio.h>
 #include "util/logger.h"
 #include "t_redis.h"
+#include "t_string.h"
 #include "ttlmanager.h"
 
 
@@ -80,7 +81,13 @@ void TTLThread::run()
                 unsigned int expireTime = *((unsigned int*)val.data);
                 if (now >= expireTime) {
                     dbClu->remove(expire_key);
-                    dbClu->remove(XObject(pExpireKey->keyBuf(), pExpireKey->keyLen));
+                    XObject key(pExpireKey->keyBuf(), pExpireKey->keyLen);
+                    if (TString::isStringKey(key)) {
+                        //Remove the chunks of a chunked string too
+                        TString(dbClu, key).remove();
+                    } else {
+                        dbClu->remove(key);
+                    }
                 }
                 it.next();
                 if (++loop == 100000) {
@@ -0,0 +1,79 @@
+﻿/*
+* Licensed to the Apache Software Foundation (ASF) under one
+* or more contributor license agreements.  See the NOTICE file
+* distributed with this work for additional information
+* regarding copyright ownership.  The ASF licenses this file
+* to you under the Apache License, Version 2.0 (the
+* "License"); you may not use this file except in compliance
+* with the License.  You may obtain a copy of the License at
+*
+*   http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing,
+* software distributed under the License is distributed on an
+* "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+* KIND, either express or implied.  See the License for the
+* specific language governing permissions and limitations
+* under the License.
+*/
+
+#ifdef __SSE4_2__
+#include <nmmintrin.h>
+#endif
+
+#include "util/crc32c.h"
+
+/* Slice-by-8 tables, built once before main() */
+class Crc32cTable
+{
+public:
+    enum { Poly = 0x82f63b78 };
+
+    Crc32cTable(void) {
+        for (unsigned int i = 0; i < 256; ++i) {
+            unsigned int crc = i;
+            for (int k = 0; k < 8; ++k) {
+                crc = (crc & 1) ? (crc >> 1) ^ Poly : (crc >> 1);
+            }
+            table[0][i] = crc;
+        }
+        for (unsigned int i = 0; i < 256; ++i) {
+            for (int k = 1; k < 8; ++k) {
+                table[k][i] = (table[k - 1][i] >> 8) ^ table[0][table[k - 1][i] & 0xff];
+            }
+        }
+    }
+
+    unsigned int table[8][256];
+};
+
+static Crc32cTable s_crc32cTable;
+
+unsigned int crc32cExtend(unsigned int crc, const char* data, int len)
+{
+    const unsigned char* p = (const unsigned char*)data;
+    unsigned int l = crc ^ 0xffffffff;
+
+#ifdef __SSE4_2__
+    unsigned long long l64 = l;
+    for (; len >= 8; p += 8, len -= 8) {
+        l64 = _mm_crc32_u64(l64, *(const unsigned long long*)p);
+    }
+    l = (unsigned int)l64;
+    for (; len > 0; ++p, --len) {
+        l = _mm_crc32_u8(l, *p);
+    }
+#else
+    const unsigned int (*t)[256] = s_crc32cTable.table;
+    for (; len >= 8; p += 8, len -= 8) {
+        unsigned int lo = l ^ (p[0] | (p[1] << 8) | (p[2] << 16) | ((unsigned int)p[3] << 24));
+        unsigned int hi = p[4] | (p[5] << 8) | (p[6] << 16) | ((unsigned int)p[7] << 24);
+        l = t[7][lo & 0xff] ^ t[6][(lo >> 8) & 0xff] ^ t[5][(lo >> 16) & 0xff] ^ t[4][lo >> 24] ^
+            t[3][hi & 0xff] ^ t[2][(hi >> 8) & 0xff] ^ t[1][(hi >> 16) & 0xff] ^ t[0][hi >> 24];
+    }
+    for (; len > 0; ++p, --len) {
+        l = t[0][(l ^ *p) & 0xff] ^ (l >> 8);
+    }
+#endif
+    return l ^ 0xffffffff;
+}
@@ -19,6 +19,8 @@
 
 #ifdef WIN32
 #include <Windows.h>
+#else
+#include <sys/time.h>
 #endif
 
 #include "locker.h"
@@ -60,6 +62,65 @@ void Mutex::unlock(void)
 }
 
 
+Condition::Condition(Mutex* mutex) :
+    m_mutex(mutex)
+{
+#ifndef WIN32
+    pthread_cond_init(&m_cond, NULL);
+#endif
+}
+
+Condition::~Condition(void)
+{
+#ifndef WIN32
+    pthread_cond_destroy(&m_cond);
+#endif
+}
+
+void Condition::wait(void)
+{
+#ifdef WIN32
+    m_mutex->unlock();
+    ::Sleep(1);
+    m_mutex->lock();
+#else
+    pthread_cond_wait(&m_cond, &m_mutex->m_mutex);
+#endif
+}
+
+bool Condition::wait(int msec)
+{
+#ifdef WIN32
+    m_mutex->unlock();
+    ::Sleep(msec < 1 ? 1 : msec);
+    m_mutex->lock();
+    return true;
+#else
+    struct timeval now;
+    gettimeofday(&now, NULL);
+    long long nsec = (long long)now.tv_usec * 1000 + (long long)(msec % 1000) * 1000000;
+    struct timespec abstime;
+    abstime.tv_sec = now.tv_sec + msec / 1000 + nsec / 1000000000;
+    abstime.tv_nsec = nsec % 1000000000;
+    return pthread_cond_timedwait(&m_cond, &m_mutex->m_mutex, &abstime) == 0;
+#endif
+}
+
+void Condition::signal(void)
+{
+#ifndef WIN32
+    pthread_cond_signal(&m_cond);
+#endif
+}
+
+void Condition::broadcast(void)
+{
+#ifndef WIN32
+    pthread_cond_broadcast(&m_cond);
+#endif
+}
+
+
 SpinLocker::SpinLocker(void)
 {
 #ifdef __LINUX__
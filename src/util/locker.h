@@ -42,6 +42,28 @@ public:
 #endif
 };
 
+class Condition
+{
+public:
+    Condition(Mutex* mutex);
+    ~Condition(void);
+
+    //The mutex must be locked by the caller
+    void wait(void);
+    //Return false if the timeout expired before being woken up
+    bool wait(int msec);
+    void signal(void);
+    void broadcast(void);
+
+private:
+    Mutex* m_mutex;
+#ifndef WIN32
+    pthread_cond_t m_cond;
+#endif
+    Condition(const Condition&);
+    Condition& operator=(const Condition&);
+};
+
 class SpinLocker
 {
 public:
@@ -153,6 +153,25 @@ bool TcpSocket::setNonBlocking(void)
     return true;
 }
 
+bool TcpSocket::setBlocking(void)
+{
+#ifdef WIN32
+    u_long nonblocking = 0;
+    if (ioctlsocket(m_socket, FIONBIO, &nonblocking) == SOCKET_ERROR) {
+        return false;
+    }
+#else
+    int flags;
+    if ((flags = fcntl(m_socket, F_GETFL, NULL)) < 0) {
+        return false;
+    }
+    if (fcntl(m_socket, F_SETFL, flags & ~O_NONBLOCK) == -1) {
+        return false;
+    }
+#endif
+    return true;
+}
+
 bool TcpSocket::setReuseaddr(void)
 {
     int reuse;
@@ -40,6 +40,10 @@ typedef socklen_t socketlen_t;
 
 #include "util/string.h"
 
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0
+#endif
+
 class HostAddress
 {
 public:
@@ -81,6 +85,7 @@ public:
     int setOption(int level, int name, char* val, socketlen_t vallen);
 
     bool setNonBlocking(void);
+    bool setBlocking(void);
     bool setReuseaddr(void);
     bool setNoDelay(void);
     bool setKeepAlive(void);
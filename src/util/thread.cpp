@@ -43,6 +43,7 @@ public:
 
     virtual void start(void) {}
     virtual void terminate(void) {}
+    virtual void join(void) {}
     bool isRunning(void) const { return m_isRunning; }
 
     bool m_isRunning;
@@ -76,6 +77,15 @@ public:
         m_tHandle = INVALID_HANDLE_VALUE;
     }
 
+    virtual void join(void)
+    {
+        if (m_tHandle != INVALID_HANDLE_VALUE) {
+            ::WaitForSingleObject(m_tHandle, INFINITE);
+            ::CloseHandle(m_tHandle);
+            m_tHandle = INVALID_HANDLE_VALUE;
+        }
+    }
+
     static DWORD WINAPI WinThreadEntry(LPVOID lp)
     {
         Thread* thread = (Thread*)lp;
@@ -94,12 +104,13 @@ class UnixThread : public ThreadPrivate
 {
 public:
     UnixThread(Thread* thread) :
-        ThreadPrivate(thread)
+        ThreadPrivate(thread),
+        m_joinable(false)
     {}
     ~UnixThread(void) {}
 
     virtual void start(void) {
-        pthread_create(&m_thread_id, NULL, UnixThreadEntry, m_thread);
+        m_joinable = (pthread_create(&m_thread_id, NULL, UnixThreadEntry, m_thread) == 0);
     }
 
     virtual void terminate(void) {
@@ -107,6 +118,13 @@ public:
         m_isRunning = false;
     }
 
+    virtual void join(void) {
+        if (m_joinable) {
+            pthread_join(m_thread_id, NULL);
+            m_joinable = false;
+        }
+    }
+
     static void* UnixThreadEntry(void* lp)
     {
         Thread* thread = (Thread*)lp;
@@ -118,6 +136,7 @@ public:
 
 private:
     pthread_t m_thread_id;
+    bool m_joinable;
 };
 
 #endif
@@ -150,6 +169,11 @@ void Thread::terminate(void)
     }
 }
 
+void Thread::join(void)
+{
+    m_priv->join();
+}
+
 bool Thread::isRunning(void) const
 {
     return m_priv->isRunning();
@@ -31,6 +31,8 @@ public:
 
     void start(void);
     void terminate(void);
+    //Wait until run() returns; the thread must stop by itself
+    void join(void);
     bool isRunning(void) const;
 
     static void sleep(int msec);
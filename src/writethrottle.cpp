@@ -0,0 +1,214 @@
+﻿/*
+* Licensed to the Apache Software Foundation (ASF) under one
+* or more contributor license agreements.  See the NOTICE file
+* distributed with this work for additional information
+* regarding copyright ownership.  The ASF licenses this file
+* to you under the Apache License, Version 2.0 (the
+* "License"); you may not use this file except in compliance
+* with the License.  You may obtain a copy of the License at
+*
+*   http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing,
+* software distributed under the License is distributed on an
+* "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+* KIND, either express or implied.  See the License for the
+* specific language governing permissions and limitations
+* under the License.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "util/thread.h"
+#include "util/logger.h"
+#include "writethrottle.h"
+
+
+class ThrottleThread : public Thread
+{
+public:
+    ThrottleThread(WriteThrottle* throttle) : m_throttle(throttle) {}
+    ~ThrottleThread(void) {}
+
+    virtual void run(void) {
+        while (true) {
+            m_throttle->check();
+            Thread::sleep(m_throttle->m_option.checkInterval);
+        }
+    }
+
+private:
+    WriteThrottle* m_throttle;
+};
+
+
+
+WriteThrottle::WriteThrottle(LeveldbCluster* dbCluster)
+{
+    m_dbCluster = dbCluster;
+    m_thread = new ThrottleThread(this);
+    m_state = Normal;
+    m_delay = 0;
+    m_delayedWrites = 0;
+    m_rejectedWrites = 0;
+}
+
+WriteThrottle::~WriteThrottle(void)
+{
+    delete m_thread;
+}
+
+void WriteThrottle::start(void)
+{
+    if (m_option.enabled) {
+        Logger::log(Logger::Message, "Write throttle started. slowdown_l0_files=%d stop_l0_files=%d "
+                        "slowdown_pending=%uMB stop_pending=%uMB max_delay=%dms",
+                        m_option.slowdownLevel0Files,
+                        m_option.stopLevel0Files,
+                        m_option.slowdownPendingBytes / 1024 / 1024,
+                        m_option.stopPendingBytes / 1024 / 1024,
+                        m_option.maxDelay);
+        m_thread->start();
+    }
+}
+
+void WriteThrottle::stop(void)
+{
+    m_thread->terminate();
+    m_state = Normal;
+    m_delay = 0;
+}
+
+const char* WriteThrottle::stateName(int state)
+{
+    switch (state) {
+    case Normal:
+        return "Normal";
+    case Slowdown:
+        return "Slowdown";
+    case Stop:
+        return "Stop";
+    default:
+        return "Unknown";
+    }
+}
+
+void WriteThrottle::shardStatus(std::vector<ShardStatus>& result)
+{
+    m_shardLock.lock();
+    result = m_shards;
+    m_shardLock.unlock();
+}
+
+/*
+    leveldb.stats looks like:
+
+                                   Compactions
+    Level  Files Size(MB) Time(sec) Read(MB) Write(MB)
+    --------------------------------------------------
+      0        2        3         0        0         3
+      1        5       10         0        0         0
+
+    The debt of level 0 is its whole size once the compaction trigger
+    (4 files) is reached, the debt of level N is the size above its
+    target (10MB * 10^(N-1)).
+*/
+bool WriteThrottle::compactionStats(Leveldb* db, int* level0Files, size_t* pendingBytes)
+{
+    std::string stats;
+    if (!db->property("leveldb.stats", stats)) {
+        return false;
+    }
+
+    *level0Files = 0;
+    *pendingBytes = 0;
+
+    size_t pos = stats.find("---");
+    if (pos == std::string::npos) {
+        return true;
+    }
+    pos = stats.find('\n', pos);
+    while (pos != std::string::npos) {
+        const char* line = stats.c_str() + pos + 1;
+        int level, files;
+        double sizeMB;
+        if (sscanf(line, "%d %d %lf", &level, &files, &sizeMB) != 3) {
+            break;
+        }
+        double bytes = sizeMB * 1024 * 1024;
+        if (level == 0) {
+            *level0Files = files;
+            if (files >= 4) {
+                *pendingBytes += (size_t)bytes;
+            }
+        } else {
+            double target = 10.0 * 1024 * 1024;
+            for (int i = 1; i < level; ++i) {
+                target *= 10;
+            }
+            if (bytes > target) {
+                *pendingBytes += (size_t)(bytes - target);
+            }
+        }
+        pos = stats.find('\n', pos + 1);
+    }
+    return true;
+}
+
+void WriteThrottle::check(void)
+{
+    std::vector<ShardStatus> shards;
+    int worst = Normal;
+    int delay = 0;
+    for (int i = 0; i < m_dbCluster->databaseCount(); ++i) {
+        Leveldb* db = m_dbCluster->database(i);
+        ShardStatus shard;
+        shard.name = db->databaseName();
+        shard.state = Normal;
+        if (!compactionStats(db, &shard.level0Files, &shard.pendingCompactionBytes)) {
+            continue;
+        }
+
+        if (shard.level0Files >= m_option.stopLevel0Files ||
+                shard.pendingCompactionBytes >= m_option.stopPendingBytes) {
+            shard.state = Stop;
+        } else if (shard.level0Files >= m_option.slowdownLevel0Files ||
+                   shard.pendingCompactionBytes >= m_option.slowdownPendingBytes) {
+            shard.state = Slowdown;
+
+            //The delay grows with every level-0 file above the slowdown trigger
+            int steps = m_option.stopLevel0Files - m_option.slowdownLevel0Files;
+            int over = shard.level0Files - m_option.slowdownLevel0Files + 1;
+            if (steps <= 0) {
+                steps = 1;
+            }
+            if (over <= 0) {
+                over = 1;
+            }
+            int d = m_option.maxDelay * over / steps;
+            if (d > m_option.maxDelay) {
+                d = m_option.maxDelay;
+            }
+            if (d > delay) {
+                delay = d;
+            }
+        }
+
+        if (shard.state > worst) {
+            worst = shard.state;
+        }
+        shards.push_back(shard);
+    }
+
+    if (worst != m_state) {
+        Logger::log(Logger::Warning, "Write throttle state changed: %s -> %s",
+                    stateName(m_state), stateName(worst));
+    }
+    m_delay = delay;
+    m_state = worst;
+
+    m_shardLock.lock();
+    m_shards.swap(shards);
+    m_shardLock.unlock();
+}
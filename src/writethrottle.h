@@ -0,0 +1,113 @@
+﻿/*
+* Licensed to the Apache Software Foundation (ASF) under one
+* or more contributor license agreements.  See the NOTICE file
+* distributed with this work for additional information
+* regarding copyright ownership.  The ASF licenses this file
+* to you under the Apache License, Version 2.0 (the
+* "License"); you may not use this file except in compliance
+* with the License.  You may obtain a copy of the License at
+*
+*   http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing,
+* software distributed under the License is distributed on an
+* "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+* KIND, either express or implied.  See the License for the
+* specific language governing permissions and limitations
+* under the License.
+*/
+
+#ifndef WRITETHROTTLE_H
+#define WRITETHROTTLE_H
+
+#include <vector>
+
+#include "util/locker.h"
+#include "leveldb.h"
+
+/*
+    Watch the compaction debt of every shard and tell the proxy how to
+    admit write commands before leveldb stalls the calling thread
+    inside Put() (level-0 slowdown/stop trigger)
+*/
+class ThrottleThread;
+class WriteThrottle
+{
+public:
+    enum State {
+        Normal = 0,
+        Slowdown = 1,
+        Stop = 2
+    };
+
+    struct Option {
+        bool enabled;
+        int slowdownLevel0Files;        //leveldb slows down at 8 files
+        int stopLevel0Files;            //leveldb stops at 12 files
+        size_t slowdownPendingBytes;
+        size_t stopPendingBytes;
+        int maxDelay;                   //msec
+        int checkInterval;              //msec
+
+        Option(void) {
+            enabled = false;
+            slowdownLevel0Files = 6;
+            stopLevel0Files = 10;
+            slowdownPendingBytes = 256 * 1024 * 1024;
+            stopPendingBytes = 1024 * 1024 * 1024;
+            maxDelay = 100;
+            checkInterval = 200;
+        }
+    };
+
+    struct ShardStatus {
+        std::string name;
+        int level0Files;
+        size_t pendingCompactionBytes;
+        int state;
+    };
+
+    WriteThrottle(LeveldbCluster* dbCluster);
+    ~WriteThrottle(void);
+
+    void setOption(const Option& opt) { m_option = opt; }
+    const Option& option(void) const { return m_option; }
+    bool isEnabled(void) const { return m_option.enabled; }
+
+    void start(void);
+    void stop(void);
+
+    //The worst state of all shards
+    int state(void) const { return m_state; }
+    //Delay for a write command in the Slowdown state (msec)
+    int writeDelay(void) const { return m_delay; }
+
+    void writeDelayed(void) { __sync_fetch_and_add(&m_delayedWrites, 1); }
+    void writeRejected(void) { __sync_fetch_and_add(&m_rejectedWrites, 1); }
+    unsigned long long delayedWrites(void) const { return m_delayedWrites; }
+    unsigned long long rejectedWrites(void) const { return m_rejectedWrites; }
+
+    void shardStatus(std::vector<ShardStatus>& result);
+
+    static const char* stateName(int state);
+
+private:
+    void check(void);
+    static bool compactionStats(Leveldb* db, int* level0Files, size_t* pendingBytes);
+
+private:
+    LeveldbCluster* m_dbCluster;
+    ThrottleThread* m_thread;
+    Option m_option;
+    volatile int m_state;
+    volatile int m_delay;
+    unsigned long long m_delayedWrites;
+    unsigned long long m_rejectedWrites;
+    Mutex m_shardLock;
+    std::vector<ShardStatus> m_shards;
+    friend class ThrottleThread;
+    WriteThrottle(const WriteThrottle&);
+    WriteThrottle& operator=(const WriteThrottle&);
+};
+
+#endif